@@ -74,7 +74,11 @@ macro(declare_arch)
     endif()
 
     if(NOT DEFINED CONFIG_MAX_MEMORY_REGIONS)
-      set(CONFIG_MAX_MEMORY_REGIONS 1)
+      set(CONFIG_MAX_MEMORY_REGIONS 16)
+    endif()
+
+    if(NOT DEFINED CONFIG_MAX_NUMA_NODES)
+      set(CONFIG_MAX_NUMA_NODES 8)
     endif()
 
     if(NOT DEFINED CONFIG_MAX_TASKS)
@@ -107,7 +111,9 @@ macro(declare_arch)
     math(EXPR CONFIG_MAPPED_SPACE_BASE "${CONFIG_KERNEL_SPACE_BASE}" OUTPUT_FORMAT HEXADECIMAL)
     math(EXPR CONFIG_MAPPED_SPACE_SIZE "${CONFIG_MAX_PHYSICAL_ADDRESS}" OUTPUT_FORMAT HEXADECIMAL)
     math(EXPR CONFIG_CAPABILITY_SPACE_BASE "${CONFIG_MAPPED_SPACE_BASE} + ${CONFIG_MAPPED_SPACE_SIZE}" OUTPUT_FORMAT HEXADECIMAL)
-    math(EXPR CONFIG_CAPABILITY_SPACE_SIZE "512 * 512 * 0x1000" OUTPUT_FORMAT HEXADECIMAL) # 1GB
+    if(NOT DEFINED CONFIG_CAPABILITY_SPACE_SIZE)
+      math(EXPR CONFIG_CAPABILITY_SPACE_SIZE "512 * 512 * 0x1000" OUTPUT_FORMAT HEXADECIMAL) # 1GB
+    endif()
     math(EXPR CONFIG_TASK_SPACE_BASE "${CONFIG_CAPABILITY_SPACE_BASE} + ${CONFIG_CAPABILITY_SPACE_SIZE}" OUTPUT_FORMAT HEXADECIMAL)
     math(EXPR CONFIG_TASK_SPACE_SIZE "0x1000 * ${CONFIG_MAX_TASKS}" OUTPUT_FORMAT HEXADECIMAL)
 
@@ -124,6 +130,7 @@ macro(declare_arch)
       CONFIG_MAX_RESERVED_REGIONS=${CONFIG_MAX_RESERVED_REGIONS}
       CONFIG_MAX_DEVICE_REGIONS=${CONFIG_MAX_DEVICE_REGIONS}
       CONFIG_MAX_MEMORY_REGIONS=${CONFIG_MAX_MEMORY_REGIONS}
+      CONFIG_MAX_NUMA_NODES=${CONFIG_MAX_NUMA_NODES}
       CONFIG_MAX_CORES=${CONFIG_MAX_CORES}
       CONFIG_MAX_TASKS=${CONFIG_MAX_TASKS}
       CONFIG_ROOT_TASK_CAP_SPACES=${CONFIG_ROOT_TASK_CAP_SPACES}
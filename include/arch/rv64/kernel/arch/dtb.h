@@ -54,7 +54,10 @@ constexpr const char* FDT_U32_TYPES[] = {
   "i-cache-sets",
   "i-cache-size",
   "i-tlb-sets",
+  "numa-node-id",
   "reservation-granule-size",
+  "riscv,cbom-block-size",
+  "riscv,cboz-block-size",
   "riscv,ndev",
   "tlb-sets",
   "tlb-size",
@@ -79,6 +82,7 @@ constexpr const char* FDT_STR_TYPES[] = {
 
 constexpr const char* FDT_ARRAY_TYPES[] = {
   "clock-frequency",
+  "distance-matrix",
   "dma-ranges",
   "initial-mapped-area",
   "interrupt-map-mask",
@@ -99,6 +103,7 @@ constexpr const char* FDT_PHANDLE_TYPES[] = {
 constexpr const char* FDT_STR_LIST_TYPES[] = {
   "compatible",
   "enable-method",
+  "riscv,isa-extensions",
 };
 
 // clang-format on
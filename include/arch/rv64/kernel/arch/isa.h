@@ -0,0 +1,32 @@
+#ifndef ARCH_RV64_KERNEL_ARCH_ISA_H_
+#define ARCH_RV64_KERNEL_ARCH_ISA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <kernel/address.h>
+#include <kernel/attribute.h>
+
+enum struct isa_ext_t : uint32_t {
+  zawrs       = 0,
+  zihintpause = 1,
+  v           = 2,
+  zicboz      = 3,
+  svpbmt      = 4,
+  zicbom      = 5,
+  svadu       = 6,
+  svnapot     = 7,
+};
+
+// Detects the extensions supported by every enabled hart from "riscv,isa" and "riscv,isa-extensions".
+__init_code void setup_isa_extensions(map_ptr<char> dtb);
+
+bool has_isa_ext(isa_ext_t ext);
+
+// Returns the cache block size zeroed by cbo.zero, or 0 if the harts do not report a common one.
+size_t get_cboz_block_size();
+
+// Returns the cache block size managed by cbo.clean/flush/inval, or 0 if the harts do not report a common one.
+size_t get_cbom_block_size();
+
+#endif // ARCH_RV64_KERNEL_ARCH_ISA_H_
@@ -273,4 +273,14 @@ inline sbiret_t sbi_cppc_write(uint32_t cppc_reg_id, uint64_t val) {
   return sbicall2(0x43505043, 3, cppc_reg_id, val);
 }
 
+constexpr uint32_t SBI_FWFT_PTE_AD_HW_UPDATING = 4;
+
+inline sbiret_t sbi_fwft_set(uint32_t feature, unsigned long value, unsigned long flags) {
+  return sbicall3(0x46574654, 0, feature, value, flags);
+}
+
+inline sbiret_t sbi_fwft_get(uint32_t feature) {
+  return sbicall1(0x46574654, 1, feature);
+}
+
 #endif // ARCH_RV64_KERNEL_SBI_H_
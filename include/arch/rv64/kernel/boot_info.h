@@ -18,7 +18,9 @@ struct boot_info_t {
   map_ptr<page_table_t>     root_page_table;
   map_ptr<cap_space_t>      cap_spaces[CONFIG_ROOT_TASK_CAP_SPACES];
   map_ptr<page_table_t>     payload_page_tables[NUM_INTER_PAGE_TABLE + 1];
+  map_ptr<page_table_t>     payload_tail_page_table;
   map_ptr<page_table_t>     stack_page_tables[NUM_INTER_PAGE_TABLE + 1];
+  map_ptr<page_table_t>     stack_tail_page_table;
   map_ptr<page_table_t>     cap_space_page_tables[NUM_INTER_PAGE_TABLE + 1];
 
   // ^^^ Generic ^^^ / vvv Arch Specific vvv
@@ -0,0 +1,11 @@
+#ifndef ARCH_RV64_KERNEL_CPU_H_
+#define ARCH_RV64_KERNEL_CPU_H_
+
+#include <cstdint>
+
+void cpu_relax();
+
+// Stalls while the byte at ptr is non-zero. It may return spuriously, so the caller must check the value again.
+void cpu_wait_while_set(const volatile uint8_t* ptr);
+
+#endif // ARCH_RV64_KERNEL_CPU_H_
@@ -0,0 +1,18 @@
+#ifndef ARCH_RV64_KERNEL_MEM_OPS_H_
+#define ARCH_RV64_KERNEL_MEM_OPS_H_
+
+#include <cstddef>
+
+#include <kernel/attribute.h>
+
+// Selects the zero and copy routines from the ISA extensions found at boot. Must be called after setup_isa_extensions.
+__init_code void setup_mem_ops();
+
+// Page clearing and user memory copies go through these instead of the generic memset and memcpy.
+void zero_memory(void* dst, size_t size);
+void copy_memory(void* dst, const void* src, size_t size);
+
+// Writes back and invalidates the cache blocks of a range before it is accessed through a non-cacheable mapping.
+void flush_memory(void* dst, size_t size);
+
+#endif // ARCH_RV64_KERNEL_MEM_OPS_H_
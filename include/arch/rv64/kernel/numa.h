@@ -0,0 +1,24 @@
+#ifndef ARCH_RV64_KERNEL_NUMA_H_
+#define ARCH_RV64_KERNEL_NUMA_H_
+
+#include <cstdint>
+
+#include <kernel/address.h>
+#include <kernel/attribute.h>
+#include <kernel/core_id.h>
+
+constexpr uint32_t NUMA_LOCAL_DISTANCE  = 10;
+constexpr uint32_t NUMA_REMOTE_DISTANCE = 20;
+
+static_assert(CONFIG_MAX_NUMA_NODES <= 256, "NUMA node ids are stored in 8 bits");
+
+// Reads "numa-node-id" of the cpu nodes and the "distance-map" node. Without them every hart and every byte of memory belongs to node 0.
+__init_code void setup_numa(map_ptr<char> dtb);
+
+// Node ids outside of CONFIG_MAX_NUMA_NODES are folded into node 0.
+uint32_t to_numa_node(uint32_t node_id);
+
+uint32_t get_core_numa_node(core_id_t core_id);
+uint32_t get_numa_distance(uint32_t from, uint32_t to);
+
+#endif // ARCH_RV64_KERNEL_NUMA_H_
@@ -1,11 +1,14 @@
 #ifndef ARCH_RV64_KERNEL_PAGE_H_
 #define ARCH_RV64_KERNEL_PAGE_H_
 
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 
 #include <kernel/address.h>
+#include <kernel/arch/isa.h>
 
 constexpr size_t PAGE_SIZE_BIT        = 12;
 constexpr size_t PAGE_SIZE            = 1 << PAGE_SIZE_BIT;
@@ -26,6 +29,10 @@ constexpr size_t TERA_PAGE_TABLE_LEVEL = 3;
 constexpr size_t MAX_PAGE_TABLE_LEVEL  = TERA_PAGE_TABLE_LEVEL;
 #endif
 
+// Svnapot maps a naturally aligned run of kilo pages as one TLB entry.
+constexpr size_t NAPOT_PAGE_COUNT = 16;
+constexpr size_t NAPOT_PAGE_SIZE  = PAGE_SIZE * NAPOT_PAGE_COUNT;
+
 constexpr size_t get_page_size(size_t level) {
   return PAGE_SIZE << (9 * level);
 }
@@ -38,6 +45,13 @@ constexpr size_t get_page_table_index(virt_ptr<void> va, size_t level) {
   return (va.raw() >> get_page_size_bit(level)) & 0x1ff;
 }
 
+// Svpbmt memory types. pma keeps the attributes of the underlying physical memory region.
+enum struct mem_type_t : uint64_t {
+  pma = 0,
+  nc  = 1,
+  io  = 2,
+};
+
 struct pte_flags_t {
   uint64_t readable  : 1;
   uint64_t writable  : 1;
@@ -46,6 +60,7 @@ struct pte_flags_t {
   uint64_t global    : 1;
 };
 
+// RSW bits: cow marks a read-only mapping that is copied on the first store.
 struct pte_t {
   uint64_t v               : 1;
   uint64_t r               : 1;
@@ -55,8 +70,12 @@ struct pte_t {
   uint64_t g               : 1;
   uint64_t a               : 1;
   uint64_t d               : 1;
-  uint64_t rsv             : 2;
+  uint64_t cow             : 1;
+  uint64_t rsw             : 1;
   uint64_t next_page_number: 44;
+  uint64_t rsv2            : 7;
+  uint64_t pbmt            : 2;
+  uint64_t n               : 1;
 
   inline void enable() {
     this->v = 1;
@@ -83,11 +102,18 @@ struct pte_t {
   }
 
   inline void set_flags(pte_flags_t flags) {
-    this->r = flags.readable;
-    this->w = flags.writable;
-    this->x = flags.executable;
-    this->u = flags.user;
-    this->g = flags.global;
+    this->r   = flags.readable;
+    this->w   = flags.writable;
+    this->x   = flags.executable;
+    this->u   = flags.user;
+    this->g   = flags.global;
+    this->cow = 0;
+    this->n   = 0;
+  }
+
+  // Without Svpbmt the PBMT bits are reserved, so every mapping keeps the PMA attributes.
+  inline void set_mem_type(mem_type_t type) {
+    this->pbmt = has_isa_ext(isa_ext_t::svpbmt) ? static_cast<uint64_t>(type) : 0;
   }
 
   inline void set_next_page(map_ptr<void> next_page) {
@@ -96,8 +122,10 @@ struct pte_t {
     this->d                = 1;
   }
 
+  // A NAPOT entry returns the base of its range, since the low bits of its page number encode the range size.
   [[nodiscard]] inline map_ptr<void> get_next_page() {
-    return phys_ptr<void>::from(this->next_page_number << PAGE_SIZE_BIT);
+    uint64_t page_number = this->n ? this->next_page_number & ~(NAPOT_PAGE_COUNT - 1) : this->next_page_number;
+    return phys_ptr<void>::from(page_number << PAGE_SIZE_BIT);
   }
 };
 
@@ -110,6 +138,69 @@ struct alignas(PAGE_SIZE) page_table_t {
     size_t index = get_page_table_index(va, level);
     return make_map_ptr(&entries[index]);
   }
+
+  // Merges the run of kilo pages containing index into one NAPOT range if they are contiguous, aligned and mapped alike.
+  inline bool merge_napot(size_t index) {
+    if (!has_isa_ext(isa_ext_t::svnapot)) {
+      return false;
+    }
+
+    size_t first = index & ~(NAPOT_PAGE_COUNT - 1);
+    pte_t  head  = entries[first];
+    if (!head.is_user() || head.n || head.cow || head.next_page_number % NAPOT_PAGE_COUNT != 0) {
+      return false;
+    }
+
+    bool accessed = false;
+    bool dirty    = false;
+    for (size_t i = 0; i < NAPOT_PAGE_COUNT; ++i) {
+      pte_t expected            = head;
+      expected.next_page_number = head.next_page_number + i;
+      expected.a                = entries[first + i].a;
+      expected.d                = entries[first + i].d;
+      if (std::bit_cast<uint64_t>(entries[first + i]) != std::bit_cast<uint64_t>(expected)) {
+        return false;
+      }
+      accessed = accessed || expected.a;
+      dirty    = dirty || expected.d;
+    }
+
+    // The hardware may update the bits of any entry in the range, so every entry starts with the bits of the whole range.
+    for (size_t i = 0; i < NAPOT_PAGE_COUNT; ++i) {
+      pte_t pte            = head;
+      pte.next_page_number = head.next_page_number | (NAPOT_PAGE_COUNT / 2);
+      pte.n                = 1;
+      pte.a                = accessed;
+      pte.d                = dirty;
+      std::atomic_ref<pte_t>(entries[first + i]).store(pte, std::memory_order_relaxed);
+    }
+
+    return true;
+  }
+
+  // Turns the NAPOT range containing index back into separate entries. Each entry keeps translating the same address.
+  inline void split_napot(size_t index) {
+    if (!entries[index].n) {
+      return;
+    }
+
+    size_t first    = index & ~(NAPOT_PAGE_COUNT - 1);
+    bool   accessed = false;
+    bool   dirty    = false;
+    for (size_t i = 0; i < NAPOT_PAGE_COUNT; ++i) {
+      accessed = accessed || entries[first + i].a;
+      dirty    = dirty || entries[first + i].d;
+    }
+
+    for (size_t i = 0; i < NAPOT_PAGE_COUNT; ++i) {
+      pte_t pte            = entries[first + i];
+      pte.next_page_number = (pte.next_page_number & ~(NAPOT_PAGE_COUNT - 1)) + i;
+      pte.n                = 0;
+      pte.a                = accessed;
+      pte.d                = dirty;
+      std::atomic_ref<pte_t>(entries[first + i]).store(pte, std::memory_order_relaxed);
+    }
+  }
 };
 
 static_assert(sizeof(page_table_t) == PAGE_SIZE);
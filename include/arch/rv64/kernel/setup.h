@@ -6,6 +6,10 @@
 #include <kernel/cap_space.h>
 #include <kernel/task.h>
 
+__init_code void setup_arch(map_ptr<boot_info_t> boot_info);
+
+__init_code void setup_arch_hart();
+
 __init_code void setup_memory_capabilities(map_ptr<boot_info_t> boot_info);
 
 __init_code void setup_arch_root_boot_info(map_ptr<boot_info_t> boot_info);
@@ -12,4 +12,10 @@ void set_trap_handler(void (*handler)());
 void enable_trap();
 void disable_trap();
 
+[[nodiscard]] uintptr_t irq_save();
+void                    irq_restore(uintptr_t flags);
+void                    irq_enable();
+void                    irq_disable();
+[[nodiscard]] bool      irq_pending();
+
 #endif // ARCH_RV64_KERNEL_TRAP_H_
@@ -23,8 +23,11 @@ union capability_t {
   } null;
 
   struct {
-    uint64_t type  : 5;
-    uint64_t device: 1;
+    uint64_t type     : 5;
+    uint64_t device   : 1;
+    uint64_t revoking : 1;
+    uint64_t allocator: 1;
+    uint64_t node     : 8;
     uint64_t size: std::countr_zero<uintptr_t>(CONFIG_MAX_PHYSICAL_ADDRESS);
     uint64_t phys_addr: std::countr_zero<uintptr_t>(CONFIG_MAX_PHYSICAL_ADDRESS);
     uint64_t used_size: std::countr_zero<uintptr_t>(CONFIG_MAX_PHYSICAL_ADDRESS);
@@ -67,6 +70,11 @@ union capability_t {
     uint64_t              readable  : 1;
     uint64_t              writable  : 1;
     uint64_t              executable: 1;
+    uint64_t              zeroed    : 1;
+    uint64_t              derived   : 1;
+    uint64_t              read_only : 1;
+    uint64_t              tracked   : 1;
+    uint64_t              mem_type  : 2;
     uint64_t              level     : 2;
     uint64_t              index: std::countr_zero<uint64_t>(NUM_PAGE_TABLE_ENTRY);
     uint64_t              phys_addr: std::countr_zero<uint64_t>(CONFIG_MAX_PHYSICAL_ADDRESS);
@@ -77,6 +85,7 @@ union capability_t {
   struct {
     uint64_t             type: 5;
     uint64_t             used: 1;
+    uint64_t             mega: 1;
     map_ptr<cap_space_t> space;
     uint64_t             unused;
   } cap_space;
@@ -167,14 +176,46 @@ constexpr capability_t make_null_cap() {
   };
 }
 
-inline capability_t make_memory_cap(bool device, size_t size, phys_ptr<void> base_addr) {
+// The bump allocator only returns memory when the whole cap is reset. The bitmap allocator frees each object on destroy.
+enum struct mem_allocator_t : uint8_t {
+  bump   = 0,
+  bitmap = 1,
+};
+
+// Range map and unmap handle this many consecutive entries per call. The buffers live on the kernel stack inside the task page.
+constexpr size_t VIRT_PAGE_RANGE_MAX_ENTRIES = 32;
+
+constexpr uintptr_t VIRT_PAGE_MAP_READABLE       = 1 << 0;
+constexpr uintptr_t VIRT_PAGE_MAP_WRITABLE       = 1 << 1;
+constexpr uintptr_t VIRT_PAGE_MAP_EXECUTABLE     = 1 << 2;
+constexpr size_t    VIRT_PAGE_MAP_MEM_TYPE_SHIFT = 3;
+constexpr uintptr_t VIRT_PAGE_MAP_MEM_TYPE_MASK  = 0x3;
+// Maps with the accessed and dirty bits cleared. A single map takes it together with the memory type.
+constexpr uintptr_t VIRT_PAGE_MAP_TRACKED = 1 << 5;
+
+// One bit per entry of a page table.
+constexpr size_t ACCESSED_DIRTY_BITMAP_WORDS = NUM_PAGE_TABLE_ENTRY / 64;
+
+struct virt_page_map_entry_t {
+  uintptr_t virt_page;
+  uintptr_t flags;
+};
+
+// Each bit of the bitmap allocator covers this many bytes. It is the size of the smallest object.
+constexpr size_t MEMORY_BITMAP_GRANULE = 64;
+
+inline capability_t make_memory_cap(bool device, size_t size, phys_ptr<void> base_addr, uint32_t node = 0) {
   assert(base_addr < CONFIG_MAX_PHYSICAL_ADDRESS);
   assert(size < CONFIG_MAX_PHYSICAL_ADDRESS);
+  assert(node < CONFIG_MAX_NUMA_NODES);
 
   return {
     .memory = {
       .type       = static_cast<uint64_t>(CAP_MEM),
       .device     = static_cast<uint64_t>(device),
+      .revoking   = 0,
+      .allocator  = 0,
+      .node       = node,
       .size       = size,
       .phys_addr  = base_addr.raw(),
       .used_size = 0,
@@ -253,6 +294,11 @@ inline capability_t make_virt_page_cap(
       .readable     = readable,
       .writable     = writable,
       .executable   = executable,
+      .zeroed       = 0,
+      .derived      = 0,
+      .read_only    = 0,
+      .tracked      = 0,
+      .mem_type     = static_cast<uint64_t>(mem_type_t::pma),
       .level        = level,
       .index        = get_page_table_index(virt_addr, level),
       .phys_addr    = phys_addr.raw(),
@@ -262,13 +308,14 @@ inline capability_t make_virt_page_cap(
   };
 }
 
-inline capability_t make_cap_space_cap(map_ptr<cap_space_t> cap_space, bool used) {
+inline capability_t make_cap_space_cap(map_ptr<cap_space_t> cap_space, bool used, bool mega) {
   assert(cap_space != nullptr);
 
   return {
     .cap_space = {
       .type   = static_cast<uint64_t>(CAP_CAP_SPACE),
       .used   = used,
+      .mega   = mega,
       .space  = cap_space,
       .unused = 0,
     },
@@ -301,6 +348,7 @@ inline capability_t make_zombie_cap() {
 capability_t make_unique_id_cap();
 
 map_ptr<cap_slot_t> create_memory_object(map_ptr<cap_slot_t> dst, map_ptr<cap_slot_t> src, size_t size, size_t alignment);
+map_ptr<cap_slot_t> create_memory_object(map_ptr<cap_slot_t> dst, map_ptr<cap_slot_t> src, size_t size, size_t alignment, bool& zeroed);
 map_ptr<cap_slot_t> create_task_object(map_ptr<cap_slot_t> dst,
                                        map_ptr<cap_slot_t> src,
                                        map_ptr<cap_slot_t> cap_space_slot,
@@ -312,9 +360,14 @@ map_ptr<cap_slot_t> create_virt_page_object(map_ptr<cap_slot_t> dst, map_ptr<cap
 map_ptr<cap_slot_t> create_cap_space_object(map_ptr<cap_slot_t> dst, map_ptr<cap_slot_t> src);
 map_ptr<cap_slot_t> create_id_object(map_ptr<cap_slot_t> dst);
 map_ptr<cap_slot_t> create_object(map_ptr<task_t> task, map_ptr<cap_slot_t> cap_slot, cap_type_t type, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4);
+map_ptr<cap_slot_t> create_objects(map_ptr<task_t> task, map_ptr<cap_slot_t> cap_slot, cap_type_t type, size_t count, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
 
 bool is_same_object(map_ptr<cap_slot_t> lhs, map_ptr<cap_slot_t> rhs);
 
+bool set_memory_allocator(map_ptr<cap_slot_t> slot, mem_allocator_t allocator);
+bool set_memory_prezero(map_ptr<cap_slot_t> slot);
+void reclaim_object_memory(map_ptr<cap_slot_t> slot);
+
 void destroy_memory_object(map_ptr<cap_slot_t> slot);
 void destroy_task_object(map_ptr<cap_slot_t> slot);
 void destroy_endpoint_object(map_ptr<cap_slot_t> slot);
@@ -325,13 +378,24 @@ void destroy_id_object(map_ptr<cap_slot_t> slot);
 
 bool map_page_table_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot);
 bool unmap_page_table_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot);
-bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot, bool readable, bool writable, bool executable);
+bool map_virt_page_cap(
+    map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot, bool readable, bool writable, bool executable, mem_type_t mem_type, bool tracked);
 bool unmap_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot);
+bool map_virt_page_caps(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, const virt_page_map_entry_t* entries, size_t count);
+bool unmap_virt_page_caps(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, const uintptr_t* virt_pages, size_t count);
 bool remap_virt_page_cap(
     map_ptr<cap_slot_t> new_page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot, bool readable, bool writable, bool executable, map_ptr<cap_slot_t> old_page_table_slot);
-
-bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_space_slot);
-bool extend_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> page_table_slot);
+bool set_virt_page_read_only(map_ptr<cap_slot_t> virt_page_slot);
+bool scan_accessed_dirty(map_ptr<cap_slot_t> page_table_slot, size_t index, size_t count, uint64_t* accessed, uint64_t* dirty, bool clear);
+bool set_accessed_dirty(map_ptr<task_t> task, virt_ptr<void> va, bool write);
+bool promote_virt_pages(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot);
+bool demote_virt_page(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot);
+bool clone_address_space(map_ptr<task_t> dst_task, map_ptr<task_t> src_task, map_ptr<cap_slot_t> mem_slot);
+bool copy_on_write(map_ptr<task_t> task, virt_ptr<void> va);
+
+bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_space_slot, uintptr_t space_index);
+bool insert_mega_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> mem_slot);
+bool extend_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> page_table_slot, uintptr_t space_index);
 
 int compare_id_cap(map_ptr<cap_slot_t> slot1, map_ptr<cap_slot_t> slot2);
 
@@ -1,25 +1,34 @@
 #ifndef KERNEL_CAP_SPACE_H_
 #define KERNEL_CAP_SPACE_H_
 
+#include <bit>
+
 #include <kernel/cap.h>
 #include <kernel/page.h>
 
 struct task_t;
 struct cap_space_t;
 
+// The derivation tree is kept as a doubly linked list in pre-order with the depth of each node, like the seL4 MDB.
+// The descendants of a slot are the consecutive slots following it that are deeper than it.
+// Copied and delegated caps are siblings of the source cap, and objects created from a memory cap are its children.
 struct cap_slot_t {
   capability_t        cap;
   map_ptr<cap_slot_t> prev;
   map_ptr<cap_slot_t> next;
+  uint32_t            depth;
 
   [[nodiscard]] map_ptr<cap_space_t> get_cap_space() const;
   [[nodiscard]] bool                 is_unused() const;
   [[nodiscard]] bool                 is_isolated() const;
   [[nodiscard]] bool                 is_head() const;
   [[nodiscard]] bool                 is_tail() const;
+  [[nodiscard]] bool                 has_children() const;
+  [[nodiscard]] map_ptr<cap_slot_t>  get_last_descendant();
 
   void                insert_before(map_ptr<cap_slot_t> slot);
   void                insert_after(map_ptr<cap_slot_t> slot);
+  void                insert_child(map_ptr<cap_slot_t> slot);
   map_ptr<cap_slot_t> erase_this();
   void                replace(map_ptr<cap_slot_t> slot);
 };
@@ -29,6 +38,10 @@ struct alignas(PAGE_SIZE) cap_space_t {
     map_ptr<cap_space_t> map;
     map_ptr<task_t>      task;
     uintptr_t            space_index;
+    uintptr_t            watermark;
+    map_ptr<cap_space_t> next_fresh;
+    map_ptr<cap_space_t> next;
+    uint64_t             retire_epoch;
   } meta_info;
 
   cap_slot_t slots[PAGE_SIZE / sizeof(cap_slot_t) - 1];
@@ -36,13 +49,49 @@ struct alignas(PAGE_SIZE) cap_space_t {
 
 static_assert(sizeof(cap_space_t) == PAGE_SIZE);
 
+constexpr size_t NUM_SLOTS_PER_CAP_SPACE = sizeof(cap_space_t::slots) / sizeof(cap_slot_t);
+
+// In the dense layout a cap descriptor is a linear slot index. In the sparse layout it is decoded like a guarded radix address:
+// | guard | space index | slot index |. The guard must match the task's cap_guard, and intermediate tables only exist for populated ranges.
+enum struct cap_layout_t : uint8_t {
+  dense  = 0,
+  sparse = 1,
+};
+
+static_assert(std::has_single_bit(CONFIG_CAPABILITY_SPACE_SIZE));
+
+constexpr size_t CAP_DESC_SLOT_BITS  = std::bit_width(NUM_SLOTS_PER_CAP_SPACE - 1);
+constexpr size_t CAP_DESC_SPACE_BITS = std::countr_zero(CONFIG_CAPABILITY_SPACE_SIZE / PAGE_SIZE);
+constexpr size_t CAP_DESC_RADIX_BITS = CAP_DESC_SLOT_BITS + CAP_DESC_SPACE_BITS;
+
+// Freed slots waiting for a grace period are marked with this depth.
+constexpr uint32_t DEFERRED_SLOT_DEPTH = UINT32_MAX;
+
+struct cap_remap_t {
+  uintptr_t old_desc;
+  uintptr_t new_desc;
+};
+
+// Number of slots destroyed per revoke syscall before it is restarted.
+constexpr size_t REVOKE_BATCH_SIZE = 64;
+
+// A mega cap space is a run of cap spaces that fills one extension and is mapped by a single mega page.
+constexpr size_t CAP_SPACES_PER_MEGA_PAGE = NUM_PAGE_TABLE_ENTRY;
+
 [[nodiscard]] bool           insert_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space);
+[[nodiscard]] bool           insert_mega_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_spaces);
+[[nodiscard]] bool           insert_cap_space_at(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, uintptr_t space_index);
+[[nodiscard]] virt_ptr<void> extend_cap_space_at(map_ptr<task_t> task, map_ptr<page_table_t> page, uintptr_t space_index, size_t& level);
+[[nodiscard]] bool           set_cap_layout(map_ptr<task_t> task, cap_layout_t layout, uintptr_t guard);
+[[nodiscard]] bool           compact_cap_space(map_ptr<task_t> task, cap_remap_t* remap, size_t max_count, size_t& count);
+[[nodiscard]] bool           release_cap_space(map_ptr<cap_space_t> cap_space, bool mega);
 [[nodiscard]] virt_ptr<void> extend_cap_space(map_ptr<task_t> task, map_ptr<page_table_t> page);
 
 [[nodiscard]] map_ptr<cap_slot_t> transfer_cap(map_ptr<task_t> task, map_ptr<cap_slot_t> src_slot);
 [[nodiscard]] map_ptr<cap_slot_t> delegate_cap(map_ptr<task_t> task, map_ptr<cap_slot_t> src_slot);
 [[nodiscard]] map_ptr<cap_slot_t> copy_cap(map_ptr<cap_slot_t> src_slot);
 [[nodiscard]] bool                revoke_cap(map_ptr<cap_slot_t> slot);
+[[nodiscard]] bool                revoke_cap_partially(map_ptr<cap_slot_t> slot, size_t max_count, bool& completed);
 [[nodiscard]] bool                destroy_cap(map_ptr<cap_slot_t> slot);
 [[nodiscard]] bool                is_same_cap(map_ptr<cap_slot_t> lhs, map_ptr<cap_slot_t> rhs);
 
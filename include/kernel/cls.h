@@ -3,12 +3,35 @@
 
 #include <kernel/task.h>
 
+constexpr size_t SLOT_MAGAZINE_SIZE = 16;
+
+// Free slots of a single task cached on a core, so that hot allocations do not take the task lock.
+struct slot_magazine_t {
+  tid_t               tid;
+  uint32_t            generation;
+  size_t              count;
+  map_ptr<cap_slot_t> slots[SLOT_MAGAZINE_SIZE];
+};
+
+constexpr size_t ID_BLOCK_SIZE_BIT = 16;
+
+// IDs reserved by a core. Once they run out, the next block is taken from a global counter with a single fetch-add.
+struct id_block_t {
+  uint64_t block;
+  uint64_t offset;
+  bool     valid;
+};
+
 struct core_local_storage_t {
   alignas(PAGE_SIZE) char idle_task_root_page_table[PAGE_SIZE];
   alignas(PAGE_SIZE) char idle_task_region[PAGE_SIZE];
   map_ptr<task_t> idle_task;
   map_ptr<task_t> current_task;
   int             errno_value;
+  bool            need_resched;
+  bool            restart_syscall;
+  slot_magazine_t slot_magazine;
+  id_block_t      id_block;
 };
 
 map_ptr<core_local_storage_t> get_cls();
@@ -16,10 +16,19 @@ struct endpoint_t {
   task_queue_t         sender_queue;
   task_queue_t         receiver_queue;
   recursive_spinlock_t lock;
+  map_ptr<task_t>      kill_notify_tasks; // Tasks whose kill_notify is this endpoint.
+  map_ptr<task_t>      fault_tasks;       // Tasks whose fault_endpoint is this endpoint.
 };
 
 static_assert(sizeof(endpoint_t) <= get_cap_size(CAP_ENDPOINT));
 
+// Page faults are delivered to the fault endpoint as MSG_TYPE_FAULT messages carrying [address, access, pc].
+enum struct fault_access_t : uintptr_t {
+  read    = 0,
+  write   = 1,
+  execute = 2,
+};
+
 bool ipc_send_short(bool blocking, map_ptr<endpoint_t> endpoint, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5);
 bool ipc_send_long(bool blocking, map_ptr<endpoint_t> endpoint, virt_ptr<message_t> msg);
 bool ipc_receive(bool blocking, map_ptr<endpoint_t> endpoint, virt_ptr<message_t> msg);
@@ -27,9 +36,11 @@ bool ipc_reply(map_ptr<endpoint_t> endpoint, virt_ptr<message_t> msg);
 bool ipc_call(map_ptr<endpoint_t> endpoint, virt_ptr<message_t> msg);
 void ipc_cancel(map_ptr<endpoint_t> endpoint);
 void ipc_send_kill_notify(map_ptr<endpoint_t> endpoint, map_ptr<task_t> task);
+bool ipc_send_fault(map_ptr<endpoint_t> endpoint, uintptr_t addr, fault_access_t access, uintptr_t pc);
 
 bool ipc_transfer_ipc_msg(map_ptr<task_t> dst, map_ptr<task_t> src);
 bool ipc_transfer_kill_msg(map_ptr<task_t> dst, map_ptr<task_t> src);
+bool ipc_transfer_fault_msg(map_ptr<task_t> dst, map_ptr<task_t> src);
 
 void push_waiting_queue(task_queue_t& queue, map_ptr<task_t> task);
 void remove_waiting_queue(task_queue_t& queue, map_ptr<task_t> task);
@@ -2,6 +2,7 @@
 #define KERNEL_LOCK_H_
 
 #include <atomic>
+#include <cstdint>
 
 struct spinlock_t {
   std::atomic_flag state;
@@ -11,6 +12,9 @@ struct spinlock_t {
   void lock();
   void unlock();
   bool try_lock();
+
+  [[nodiscard]] uintptr_t lock_irqsave();
+  void                    unlock_irqrestore(uintptr_t flags);
 };
 
 struct recursive_spinlock_t {
@@ -23,6 +27,23 @@ struct recursive_spinlock_t {
   void lock();
   void unlock();
   bool try_lock();
+
+  [[nodiscard]] uintptr_t lock_irqsave();
+  void                    unlock_irqrestore(uintptr_t flags);
+};
+
+template<typename T>
+struct irqsave_lock_guard {
+  T&        lock;
+  uintptr_t flags;
+
+  explicit irqsave_lock_guard(T& lock): lock(lock), flags(lock.lock_irqsave()) { }
+  ~irqsave_lock_guard() {
+    lock.unlock_irqrestore(flags);
+  }
+
+  irqsave_lock_guard(const irqsave_lock_guard&)            = delete;
+  irqsave_lock_guard& operator=(const irqsave_lock_guard&) = delete;
 };
 
 #endif // KERNEL_LOCK_H_
@@ -0,0 +1,16 @@
+#ifndef KERNEL_RCU_H_
+#define KERNEL_RCU_H_
+
+#include <cstdint>
+
+// Quiescent-state based reclamation.
+// Lock-free readers must not keep a reference to a cap slot across a return to user mode or a switch to the idle task, so both are reported as quiescent states.
+// An object retired at epoch E can be reused once every online core has reported a quiescent state at E or later.
+
+void rcu_online();
+void rcu_quiescent_state();
+
+[[nodiscard]] uint64_t rcu_retire_epoch();
+[[nodiscard]] bool     rcu_is_expired(uint64_t epoch);
+
+#endif // KERNEL_RCU_H_
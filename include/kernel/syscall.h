@@ -3,6 +3,7 @@
 
 #include <cerrno>
 
+#include <kernel/cls.h>
 #include <kernel/task.h>
 #include <libcaprese/syscall.h>
 
@@ -49,6 +50,12 @@ inline sysret_t errno_to_sysret() {
   return sysret_t { 0, errno };
 }
 
+// The result is discarded and the same syscall is issued again on return to user mode.
+inline sysret_t restart_syscall() {
+  get_cls()->restart_syscall = true;
+  return sysret_s_ok(0);
+}
+
 constexpr inline const char* sysret_error_to_str(sysret_error_t err) {
   switch (err) {
     case SYS_S_OK:
@@ -10,6 +10,26 @@ sysret_t invoke_sys_cap_copy(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_cap_revoke(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_cap_destroy(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_cap_same(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_cap_batch(map_ptr<syscall_args_t> args);
+
+enum struct cap_batch_op_t : uint32_t {
+  copy     = 0,
+  revoke   = 1,
+  destroy  = 2,
+  transfer = 3,
+  delegate = 4,
+};
+
+struct cap_batch_entry_t {
+  cap_batch_op_t op;
+  uint32_t       unused;
+  uintptr_t      task_cap;
+  uintptr_t      cap;
+  uintptr_t      result;
+  sysret_error_t error;
+};
+
+constexpr size_t CAP_BATCH_MAX_ENTRIES = 16;
 
 // clang-format off
 
@@ -19,6 +39,7 @@ constexpr sysret_t (*const sysns_cap_table[])(map_ptr<syscall_args_t>) = {
   [SYS_CAP_REVOKE & 0xffff]  = invoke_sys_cap_revoke,
   [SYS_CAP_DESTROY & 0xffff] = invoke_sys_cap_destroy,
   [SYS_CAP_SAME & 0xffff]    = invoke_sys_cap_same,
+  [SYS_CAP_BATCH & 0xffff]   = invoke_sys_cap_batch,
 };
 
 // clang-format on
@@ -10,15 +10,23 @@ sysret_t invoke_sys_mem_cap_phys_addr(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_mem_cap_size(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_mem_cap_used_size(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_mem_cap_create_object(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_mem_cap_set_allocator(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_mem_cap_create_objects(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_mem_cap_prezero(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_mem_cap_node(map_ptr<syscall_args_t> args);
 
 // clang-format off
 
 constexpr sysret_t (*const sysns_mem_cap_table[])(map_ptr<syscall_args_t>) = {
-  [SYS_MEM_CAP_DEVICE & 0xffff]        = invoke_sys_mem_cap_device,
-  [SYS_MEM_CAP_PHYS_ADDR & 0xffff]     = invoke_sys_mem_cap_phys_addr,
-  [SYS_MEM_CAP_SIZE & 0xffff]          = invoke_sys_mem_cap_size,
-  [SYS_MEM_CAP_USED_SIZE & 0xffff]     = invoke_sys_mem_cap_used_size,
-  [SYS_MEM_CAP_CREATE_OBJECT & 0xffff] = invoke_sys_mem_cap_create_object,
+  [SYS_MEM_CAP_DEVICE & 0xffff]         = invoke_sys_mem_cap_device,
+  [SYS_MEM_CAP_PHYS_ADDR & 0xffff]      = invoke_sys_mem_cap_phys_addr,
+  [SYS_MEM_CAP_SIZE & 0xffff]           = invoke_sys_mem_cap_size,
+  [SYS_MEM_CAP_USED_SIZE & 0xffff]      = invoke_sys_mem_cap_used_size,
+  [SYS_MEM_CAP_CREATE_OBJECT & 0xffff]  = invoke_sys_mem_cap_create_object,
+  [SYS_MEM_CAP_SET_ALLOCATOR & 0xffff]  = invoke_sys_mem_cap_set_allocator,
+  [SYS_MEM_CAP_CREATE_OBJECTS & 0xffff] = invoke_sys_mem_cap_create_objects,
+  [SYS_MEM_CAP_PREZERO & 0xffff]        = invoke_sys_mem_cap_prezero,
+  [SYS_MEM_CAP_NODE & 0xffff]           = invoke_sys_mem_cap_node,
 };
 
 // clang-format on
@@ -13,18 +13,28 @@ sysret_t invoke_sys_page_table_cap_map_page(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_page_table_cap_unmap_page(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_page_table_cap_remap_page(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_page_table_cap_virt_addr_base(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_page_table_cap_map_pages(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_page_table_cap_unmap_pages(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_page_table_cap_scan_accessed_dirty(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_page_table_cap_promote(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_page_table_cap_demote(map_ptr<syscall_args_t> args);
 
 // clang-format off
 
 constexpr sysret_t (*const sysns_page_table_cap_table[])(map_ptr<syscall_args_t>) = {
-  [SYS_PAGE_TABLE_CAP_MAPPED & 0xffff]         = invoke_sys_page_table_cap_mapped,
-  [SYS_PAGE_TABLE_CAP_LEVEL & 0xffff]          = invoke_sys_page_table_cap_level,
-  [SYS_PAGE_TABLE_CAP_MAP_TABLE & 0xffff]      = invoke_sys_page_table_cap_map_table,
-  [SYS_PAGE_TABLE_CAP_UNMAP_TABLE & 0xffff]    = invoke_sys_page_table_cap_unmap_table,
-  [SYS_PAGE_TABLE_CAP_MAP_PAGE & 0xffff]       = invoke_sys_page_table_cap_map_page,
-  [SYS_PAGE_TABLE_CAP_UNMAP_PAGE & 0xffff]     = invoke_sys_page_table_cap_unmap_page,
-  [SYS_PAGE_TABLE_CAP_REMAP_PAGE & 0xffff]     = invoke_sys_page_table_cap_remap_page,
-  [SYS_PAGE_TABLE_CAP_VIRT_ADDR_BASE & 0xffff] = invoke_sys_page_table_cap_virt_addr_base,
+  [SYS_PAGE_TABLE_CAP_MAPPED & 0xffff]              = invoke_sys_page_table_cap_mapped,
+  [SYS_PAGE_TABLE_CAP_LEVEL & 0xffff]               = invoke_sys_page_table_cap_level,
+  [SYS_PAGE_TABLE_CAP_MAP_TABLE & 0xffff]           = invoke_sys_page_table_cap_map_table,
+  [SYS_PAGE_TABLE_CAP_UNMAP_TABLE & 0xffff]         = invoke_sys_page_table_cap_unmap_table,
+  [SYS_PAGE_TABLE_CAP_MAP_PAGE & 0xffff]            = invoke_sys_page_table_cap_map_page,
+  [SYS_PAGE_TABLE_CAP_UNMAP_PAGE & 0xffff]          = invoke_sys_page_table_cap_unmap_page,
+  [SYS_PAGE_TABLE_CAP_REMAP_PAGE & 0xffff]          = invoke_sys_page_table_cap_remap_page,
+  [SYS_PAGE_TABLE_CAP_VIRT_ADDR_BASE & 0xffff]      = invoke_sys_page_table_cap_virt_addr_base,
+  [SYS_PAGE_TABLE_CAP_MAP_PAGES & 0xffff]           = invoke_sys_page_table_cap_map_pages,
+  [SYS_PAGE_TABLE_CAP_UNMAP_PAGES & 0xffff]         = invoke_sys_page_table_cap_unmap_pages,
+  [SYS_PAGE_TABLE_CAP_SCAN_ACCESSED_DIRTY & 0xffff] = invoke_sys_page_table_cap_scan_accessed_dirty,
+  [SYS_PAGE_TABLE_CAP_PROMOTE & 0xffff]             = invoke_sys_page_table_cap_promote,
+  [SYS_PAGE_TABLE_CAP_DEMOTE & 0xffff]              = invoke_sys_page_table_cap_demote,
 };
 
 // clang-format on
@@ -14,6 +14,8 @@ sysret_t invoke_sys_system_caps_per_cap_space(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_system_yield(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_system_cap_size(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_system_cap_align(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_system_core_node(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_system_node_distance(map_ptr<syscall_args_t> args);
 
 // clang-format off
 
@@ -27,6 +29,8 @@ constexpr sysret_t (*const sysns_system_table[])(map_ptr<syscall_args_t>) = {
   [SYS_SYSTEM_YIELD & 0xffff]              = invoke_sys_system_yield,
   [SYS_SYSTEM_CAP_SIZE & 0xffff]           = invoke_sys_system_cap_size,
   [SYS_SYSTEM_CAP_ALIGN & 0xffff]          = invoke_sys_system_cap_align,
+  [SYS_SYSTEM_CORE_NODE & 0xffff]          = invoke_sys_system_core_node,
+  [SYS_SYSTEM_NODE_DISTANCE & 0xffff]      = invoke_sys_system_node_distance,
 };
 
 // clang-format on
@@ -24,6 +24,13 @@ sysret_t invoke_sys_task_cap_get_cap_space_ext_count(map_ptr<syscall_args_t> arg
 sysret_t invoke_sys_task_cap_insert_cap_space(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_task_cap_extend_cap_space(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_task_cap_set_kill_notify(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_task_cap_insert_mega_cap_space(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_task_cap_set_cap_layout(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_task_cap_compact_cap_space(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_task_cap_set_fault_endpoint(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_task_cap_clone(map_ptr<syscall_args_t> args);
+
+constexpr size_t CAP_REMAP_MAX_ENTRIES = 32;
 
 // clang-format off
 
@@ -47,6 +54,11 @@ constexpr sysret_t (*const sysns_task_cap_table[])(map_ptr<syscall_args_t>) = {
   [SYS_TASK_CAP_INSERT_CAP_SPACE & 0xffff]        = invoke_sys_task_cap_insert_cap_space,
   [SYS_TASK_CAP_EXTEND_CAP_SPACE & 0xffff]        = invoke_sys_task_cap_extend_cap_space,
   [SYS_TASK_CAP_SET_KILL_NOTIFY & 0xffff]         = invoke_sys_task_cap_set_kill_notify,
+  [SYS_TASK_CAP_INSERT_MEGA_CAP_SPACE & 0xffff]   = invoke_sys_task_cap_insert_mega_cap_space,
+  [SYS_TASK_CAP_SET_CAP_LAYOUT & 0xffff]          = invoke_sys_task_cap_set_cap_layout,
+  [SYS_TASK_CAP_COMPACT_CAP_SPACE & 0xffff]       = invoke_sys_task_cap_compact_cap_space,
+  [SYS_TASK_CAP_SET_FAULT_ENDPOINT & 0xffff]      = invoke_sys_task_cap_set_fault_endpoint,
+  [SYS_TASK_CAP_CLONE & 0xffff]                   = invoke_sys_task_cap_clone,
 };
 
 // clang-format on
@@ -12,17 +12,23 @@ sysret_t invoke_sys_virt_page_cap_executable(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_virt_page_cap_level(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_virt_page_cap_phys_addr(map_ptr<syscall_args_t> args);
 sysret_t invoke_sys_virt_page_cap_virt_addr(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_virt_page_cap_mem_type(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_virt_page_cap_read_only(map_ptr<syscall_args_t> args);
+sysret_t invoke_sys_virt_page_cap_set_read_only(map_ptr<syscall_args_t> args);
 
 // clang-format off
 
 constexpr sysret_t (*const sysns_virt_page_cap_table[])(map_ptr<syscall_args_t>) = {
-  [SYS_VIRT_PAGE_CAP_MAPPED & 0xffff]     = invoke_sys_virt_page_cap_mapped,
-  [SYS_VIRT_PAGE_CAP_READABLE & 0xffff]   = invoke_sys_virt_page_cap_readable,
-  [SYS_VIRT_PAGE_CAP_WRITABLE & 0xffff]   = invoke_sys_virt_page_cap_writable,
-  [SYS_VIRT_PAGE_CAP_EXECUTABLE & 0xffff] = invoke_sys_virt_page_cap_executable,
-  [SYS_VIRT_PAGE_CAP_LEVEL & 0xffff]      = invoke_sys_virt_page_cap_level,
-  [SYS_VIRT_PAGE_CAP_PHYS_ADDR & 0xffff]  = invoke_sys_virt_page_cap_phys_addr,
-  [SYS_VIRT_PAGE_CAP_VIRT_ADDR & 0xffff]  = invoke_sys_virt_page_cap_virt_addr,
+  [SYS_VIRT_PAGE_CAP_MAPPED & 0xffff]        = invoke_sys_virt_page_cap_mapped,
+  [SYS_VIRT_PAGE_CAP_READABLE & 0xffff]      = invoke_sys_virt_page_cap_readable,
+  [SYS_VIRT_PAGE_CAP_WRITABLE & 0xffff]      = invoke_sys_virt_page_cap_writable,
+  [SYS_VIRT_PAGE_CAP_EXECUTABLE & 0xffff]    = invoke_sys_virt_page_cap_executable,
+  [SYS_VIRT_PAGE_CAP_LEVEL & 0xffff]         = invoke_sys_virt_page_cap_level,
+  [SYS_VIRT_PAGE_CAP_PHYS_ADDR & 0xffff]     = invoke_sys_virt_page_cap_phys_addr,
+  [SYS_VIRT_PAGE_CAP_VIRT_ADDR & 0xffff]     = invoke_sys_virt_page_cap_virt_addr,
+  [SYS_VIRT_PAGE_CAP_MEM_TYPE & 0xffff]      = invoke_sys_virt_page_cap_mem_type,
+  [SYS_VIRT_PAGE_CAP_READ_ONLY & 0xffff]     = invoke_sys_virt_page_cap_read_only,
+  [SYS_VIRT_PAGE_CAP_SET_READ_ONLY & 0xffff] = invoke_sys_virt_page_cap_set_read_only,
 };
 
 // clang-format on
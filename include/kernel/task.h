@@ -50,9 +50,10 @@ enum struct ipc_state_t : uint8_t {
 };
 
 enum struct event_type_t : uint8_t {
-  none = 0,
-  send = 1,
-  kill = 2,
+  none  = 0,
+  send  = 1,
+  kill  = 2,
+  fault = 3,
 };
 
 enum struct ipc_msg_state_t : uint8_t {
@@ -110,9 +111,22 @@ struct alignas(PAGE_SIZE) task_t {
   map_ptr<task_t>       callee_task;
   map_ptr<cap_slot_t>   free_slots;
   size_t                free_slots_count;
+  map_ptr<cap_slot_t>   deferred_slots_head;
+  map_ptr<cap_slot_t>   deferred_slots_tail;
+  size_t                deferred_slots_count;
+  map_ptr<cap_space_t>  fresh_cap_spaces;
+  map_ptr<cap_space_t>  cap_spaces;
+  uint32_t              slot_generation;
+  uintptr_t             cap_guard;
   map_ptr<page_table_t> root_page_table;
   map_ptr<endpoint_t>   endpoint;
   map_ptr<endpoint_t>   kill_notify;
+  map_ptr<endpoint_t>   fault_endpoint;
+  map_ptr<task_t>       next_kill_notify_task;
+  map_ptr<task_t>       next_fault_task;
+  map_ptr<cap_slot_t>   cow_memory;
+  map_ptr<task_t>       next_cow_memory_task;
+  map_ptr<task_t>       cow_memory_tasks; // Tasks whose cow_memory is a slot of this task.
   recursive_spinlock_t  lock;
 
   union {
@@ -121,6 +135,7 @@ struct alignas(PAGE_SIZE) task_t {
   };
 
   task_state_t    state;
+  cap_layout_t    cap_layout;
   ipc_state_t     ipc_state;
   ipc_msg_state_t ipc_msg_state;
   event_type_t    event_type;
@@ -137,6 +152,11 @@ void init_idle_task(map_ptr<task_t> task, map_ptr<page_table_t> root_page_table)
 [[nodiscard]] map_ptr<cap_slot_t> insert_cap(map_ptr<task_t> task, capability_t cap);
 void                              push_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot);
 [[nodiscard]] map_ptr<cap_slot_t> pop_free_slots(map_ptr<task_t> task);
+[[nodiscard]] map_ptr<cap_slot_t> take_free_slot(map_ptr<task_t> task);
+[[nodiscard]] map_ptr<cap_slot_t> take_fresh_slots(map_ptr<task_t> task, size_t count);
+void                              defer_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot);
+void                              reclaim_deferred_slots(map_ptr<task_t> task);
+[[nodiscard]] size_t              get_free_slot_count(map_ptr<task_t> task);
 
 void kill_task(map_ptr<task_t> task, int exit_status);
 void switch_task(map_ptr<task_t> task);
@@ -144,6 +164,10 @@ void suspend_task(map_ptr<task_t> task);
 void resume_task(map_ptr<task_t> task);
 
 void set_kill_notify(map_ptr<task_t> task, map_ptr<endpoint_t> ep);
+void set_fault_endpoint(map_ptr<task_t> task, map_ptr<endpoint_t> ep);
+void clear_endpoint_refs(map_ptr<endpoint_t> ep);
+void set_cow_memory(map_ptr<task_t> task, map_ptr<cap_slot_t> mem_slot);
+void replace_cow_memory(map_ptr<task_t> mem_task, map_ptr<cap_slot_t> old_slot, map_ptr<cap_slot_t> new_slot);
 
 void            push_ready_queue(map_ptr<task_t> task);
 void            remove_ready_queue(map_ptr<task_t> task);
@@ -153,6 +177,7 @@ map_ptr<task_t> pop_ready_task();
 
 void resched();
 void yield();
+bool preempt_point();
 
 void idle();
 
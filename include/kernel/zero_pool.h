@@ -0,0 +1,17 @@
+#ifndef KERNEL_ZERO_POOL_H_
+#define KERNEL_ZERO_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory caps registered here are zeroed in the background by idle cores.
+// Each region keeps one zeroed extent above everything allocated from it, so objects carved from that extent need no memset.
+
+constexpr size_t ZERO_POOL_MAX_REGIONS = 8;
+
+[[nodiscard]] bool add_zero_pool_region(uintptr_t phys_addr, size_t size, uintptr_t free_addr);
+void               remove_zero_pool_region(uintptr_t phys_addr, size_t size);
+[[nodiscard]] bool take_zeroed_range(uintptr_t region_addr, size_t region_size, uintptr_t phys_addr, size_t size);
+bool               zero_pool_work();
+
+#endif // KERNEL_ZERO_POOL_H_
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+
+#include <kernel/arch/dtb.h>
+#include <kernel/arch/isa.h>
+#include <kernel/log.h>
+
+namespace {
+  constexpr const char* tag = "arch/isa";
+
+  // clang-format off
+
+  constexpr const char* ISA_EXT_NAMES[] = {
+    [static_cast<uint32_t>(isa_ext_t::zawrs)]       = "zawrs",
+    [static_cast<uint32_t>(isa_ext_t::zihintpause)] = "zihintpause",
+    [static_cast<uint32_t>(isa_ext_t::v)]           = "v",
+    [static_cast<uint32_t>(isa_ext_t::zicboz)]      = "zicboz",
+    [static_cast<uint32_t>(isa_ext_t::svpbmt)]      = "svpbmt",
+    [static_cast<uint32_t>(isa_ext_t::zicbom)]      = "zicbom",
+    [static_cast<uint32_t>(isa_ext_t::svadu)]       = "svadu",
+    [static_cast<uint32_t>(isa_ext_t::svnapot)]     = "svnapot",
+  };
+
+  // clang-format on
+
+  uint64_t isa_exts;
+  size_t   cboz_block_size;
+  size_t   cbom_block_size;
+
+  __init_data bool     isa_exts_found;
+  __init_data bool     cpu_disabled;
+  __init_data uint64_t cpu_exts;
+  __init_data uint32_t cpu_cboz_block_size;
+  __init_data uint32_t cpu_cbom_block_size;
+
+  __init_code uint64_t find_isa_ext(const char* name, size_t len) {
+    for (size_t i = 0; i < std::size(ISA_EXT_NAMES); ++i) {
+      if (strlen(ISA_EXT_NAMES[i]) == len && strncmp(ISA_EXT_NAMES[i], name, len) == 0) {
+        return 1ull << i;
+      }
+    }
+    return 0;
+  }
+
+  // e.g. "rv64imafdcv_zicsr_zifencei_zawrs"
+  __init_code uint64_t parse_isa_str(const char* isa) {
+    if (strncmp(isa, "rv64", 4) != 0) [[unlikely]] {
+      logw(tag, "Unknown ISA string: %s", isa);
+      return 0;
+    }
+
+    uint64_t exts = 0;
+
+    const char* ptr = isa + 4;
+    for (; *ptr != '\0' && *ptr != '_'; ++ptr) {
+      exts |= find_isa_ext(ptr, 1);
+    }
+
+    while (*ptr == '_') {
+      const char* name = ++ptr;
+      while (*ptr != '\0' && *ptr != '_') {
+        ++ptr;
+      }
+      exts |= find_isa_ext(name, ptr - name);
+    }
+
+    return exts;
+  }
+} // namespace
+
+__init_code void setup_isa_extensions(map_ptr<char> dtb) {
+  isa_exts        = 0;
+  cboz_block_size = 0;
+  cbom_block_size = 0;
+  isa_exts_found  = false;
+
+  for_each_dtb_node(dtb, [](map_ptr<dtb_node_t> node) {
+    if (strcmp("cpu", node->name) != 0) {
+      return true;
+    }
+
+    cpu_disabled        = false;
+    cpu_exts            = 0;
+    cpu_cboz_block_size = 0;
+    cpu_cbom_block_size = 0;
+
+    for_each_dtb_prop(node, []([[maybe_unused]] map_ptr<dtb_node_t> node, map_ptr<dtb_prop_t> prop) {
+      if (strcmp(prop->name, "riscv,isa") == 0) {
+        cpu_exts |= parse_isa_str(prop->str);
+      } else if (strcmp(prop->name, "riscv,isa-extensions") == 0) {
+        for (uint32_t offset = 0; offset < prop->str_list.length; offset += strlen(prop->str_list.data + offset) + 1) {
+          const char* name  = prop->str_list.data + offset;
+          cpu_exts         |= find_isa_ext(name, strlen(name));
+        }
+      } else if (strcmp(prop->name, "riscv,cboz-block-size") == 0) {
+        cpu_cboz_block_size = prop->u32;
+      } else if (strcmp(prop->name, "riscv,cbom-block-size") == 0) {
+        cpu_cbom_block_size = prop->u32;
+      } else if (strcmp(prop->name, "status") == 0) {
+        cpu_disabled = strcmp(prop->str, "okay") != 0 && strcmp(prop->str, "ok") != 0;
+      }
+      return true;
+    });
+
+    if (cpu_disabled) {
+      return true;
+    }
+
+    // Only the extensions common to all harts can be used, since a task may migrate to any of them.
+    isa_exts        = isa_exts_found ? isa_exts & cpu_exts : cpu_exts;
+    cboz_block_size = isa_exts_found ? std::min<size_t>(cboz_block_size, cpu_cboz_block_size) : cpu_cboz_block_size;
+    cbom_block_size = isa_exts_found ? std::min<size_t>(cbom_block_size, cpu_cbom_block_size) : cpu_cbom_block_size;
+    isa_exts_found  = true;
+
+    return true;
+  });
+
+  for (size_t i = 0; i < std::size(ISA_EXT_NAMES); ++i) {
+    if (isa_exts & (1ull << i)) {
+      logi(tag, "ISA extension found: %s", ISA_EXT_NAMES[i]);
+    }
+  }
+}
+
+bool has_isa_ext(isa_ext_t ext) {
+  return isa_exts & (1ull << static_cast<uint32_t>(ext));
+}
+
+size_t get_cboz_block_size() {
+  return std::has_single_bit(cboz_block_size) ? cboz_block_size : 0;
+}
+
+size_t get_cbom_block_size() {
+  return std::has_single_bit(cbom_block_size) ? cbom_block_size : 0;
+}
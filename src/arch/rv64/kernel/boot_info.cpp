@@ -14,7 +14,9 @@ namespace {
   cap_space_t  root_task_cap_spaces[CONFIG_ROOT_TASK_CAP_SPACES];
   page_table_t root_task_root_page_table;
   page_table_t root_task_payload_page_tables[NUM_INTER_PAGE_TABLE + 1];
+  page_table_t root_task_payload_tail_page_table;
   page_table_t root_task_stack_page_tables[NUM_INTER_PAGE_TABLE + 1];
+  page_table_t root_task_stack_tail_page_table;
   page_table_t root_task_cap_space_page_tables[NUM_INTER_PAGE_TABLE + 1];
 
   static_assert(CONFIG_ROOT_TASK_CAP_SPACES < NUM_PAGE_TABLE_ENTRY);
@@ -27,6 +29,9 @@ void init_boot_info(core_id_t core_id, map_ptr<char> dtb) {
   boot_info.root_task       = make_map_ptr(&root_task);
   boot_info.root_page_table = make_map_ptr(&root_task_root_page_table);
   boot_info.dtb             = dtb;
+
+  boot_info.payload_tail_page_table = make_map_ptr(&root_task_payload_tail_page_table);
+  boot_info.stack_tail_page_table   = make_map_ptr(&root_task_stack_tail_page_table);
   std::transform(std::begin(root_task_cap_spaces), std::end(root_task_cap_spaces), boot_info.cap_spaces, [](auto&& cap_space) { return make_map_ptr(&cap_space); });
   std::transform(std::begin(root_task_payload_page_tables), std::end(root_task_payload_page_tables), boot_info.payload_page_tables, [](auto&& page_table) { return make_map_ptr(&page_table); });
   std::transform(std::begin(root_task_stack_page_tables), std::end(root_task_stack_page_tables), boot_info.stack_page_tables, [](auto&& page_table) { return make_map_ptr(&page_table); });
@@ -0,0 +1,26 @@
+#include <kernel/arch/isa.h>
+#include <kernel/cpu.h>
+
+void cpu_relax() {
+  // pause (Zihintpause). It is encoded as a FENCE hint, so it executes as a no-op on harts without the extension.
+  asm volatile(".4byte 0x0100000f" : : : "memory");
+}
+
+void cpu_wait_while_set(const volatile uint8_t* ptr) {
+  if (!has_isa_ext(isa_ext_t::zawrs)) {
+    cpu_relax();
+    return;
+  }
+
+  uintptr_t addr  = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t word  = addr & ~static_cast<uintptr_t>(sizeof(uint32_t) - 1);
+  uint32_t  shift = (addr - word) * 8;
+  uint32_t  value;
+
+  // Register a reservation set on the word, then re-check it to avoid missing a release that happened before the reservation.
+  asm volatile("lr.w %0, (%1)" : "=r"(value) : "r"(word) : "memory");
+  if ((value >> shift) & 0xff) {
+    // wrs.nto (Zawrs): stall until the reservation set is invalidated by a store from another hart.
+    asm volatile(".4byte 0x00d00073" : : : "memory");
+  }
+}
@@ -0,0 +1,98 @@
+#include <bit>
+#include <cstring>
+#include <iterator>
+
+#include <kernel/arch/dtb.h>
+#include <kernel/log.h>
+#include <kernel/numa.h>
+
+namespace {
+  constexpr const char* tag = "kernel/numa";
+
+  uint8_t core_nodes[CONFIG_MAX_CORES];
+  uint8_t distances[CONFIG_MAX_NUMA_NODES][CONFIG_MAX_NUMA_NODES];
+
+  __init_data uint32_t cpu_node;
+
+  __init_code void set_default_distances() {
+    for (uint32_t from = 0; from < CONFIG_MAX_NUMA_NODES; ++from) {
+      for (uint32_t to = 0; to < CONFIG_MAX_NUMA_NODES; ++to) {
+        distances[from][to] = from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+      }
+    }
+  }
+
+  // Each entry of "distance-matrix" is a <from to distance> triplet.
+  __init_code void parse_distance_matrix(map_ptr<dtb_prop_t> prop) {
+    const uint32_t* data   = reinterpret_cast<const uint32_t*>(prop->array.data);
+    const uint32_t  length = prop->array.length / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i + 2 < length; i += 3) {
+      uint32_t from     = std::byteswap(data[i]);
+      uint32_t to       = std::byteswap(data[i + 1]);
+      uint32_t distance = std::byteswap(data[i + 2]);
+
+      if (from >= CONFIG_MAX_NUMA_NODES || to >= CONFIG_MAX_NUMA_NODES || distance > UINT8_MAX) [[unlikely]] {
+        logw(tag, "Ignoring NUMA distance: %u -> %u (%u)", from, to, distance);
+        continue;
+      }
+
+      distances[from][to] = distance;
+      logd(tag, "NUMA distance: %u -> %u (%u)", from, to, distance);
+    }
+  }
+} // namespace
+
+__init_code void setup_numa(map_ptr<char> dtb) {
+  memset(core_nodes, 0, sizeof(core_nodes));
+  set_default_distances();
+
+  for_each_dtb_node(dtb, [](map_ptr<dtb_node_t> node) {
+    if (strcmp("cpu", node->name) == 0) {
+      cpu_node = 0;
+
+      for_each_dtb_prop(node, []([[maybe_unused]] map_ptr<dtb_node_t> node, map_ptr<dtb_prop_t> prop) {
+        if (strcmp(prop->name, "numa-node-id") == 0) {
+          cpu_node = to_numa_node(prop->u32);
+          return false;
+        }
+        return true;
+      });
+
+      // The unit address of a cpu node is its hart id, which is also the core id.
+      if (node->unit_address < std::size(core_nodes)) {
+        core_nodes[node->unit_address] = cpu_node;
+        logd(tag, "Hart %lu belongs to NUMA node %u", node->unit_address, cpu_node);
+      }
+    } else if (strcmp("distance-map", node->name) == 0) {
+      for_each_dtb_prop(node, []([[maybe_unused]] map_ptr<dtb_node_t> node, map_ptr<dtb_prop_t> prop) {
+        if (strcmp(prop->name, "distance-matrix") == 0) {
+          parse_distance_matrix(prop);
+          return false;
+        }
+        return true;
+      });
+    }
+
+    return true;
+  });
+}
+
+uint32_t to_numa_node(uint32_t node_id) {
+  if (node_id >= CONFIG_MAX_NUMA_NODES) [[unlikely]] {
+    logw(tag, "NUMA node id out of range: %u", node_id);
+    return 0;
+  }
+  return node_id;
+}
+
+uint32_t get_core_numa_node(core_id_t core_id) {
+  return core_id < std::size(core_nodes) ? core_nodes[core_id] : 0;
+}
+
+uint32_t get_numa_distance(uint32_t from, uint32_t to) {
+  if (from >= CONFIG_MAX_NUMA_NODES || to >= CONFIG_MAX_NUMA_NODES) [[unlikely]] {
+    return 0;
+  }
+  return distances[from][to];
+}
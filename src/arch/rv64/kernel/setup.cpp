@@ -5,8 +5,12 @@
 
 #include <kernel/align.h>
 #include <kernel/arch/dtb.h>
+#include <kernel/arch/isa.h>
+#include <kernel/arch/sbi.h>
 #include <kernel/cap.h>
 #include <kernel/log.h>
+#include <kernel/mem_ops.h>
+#include <kernel/numa.h>
 #include <kernel/setup.h>
 
 extern "C" {
@@ -24,12 +28,13 @@ namespace {
   struct region_t {
     phys_ptr<const char> start;
     phys_ptr<const char> end;
+    uint32_t             node = 0;
   };
 
   // a - b
   inline void subtract_region(region_t a, region_t b, region_t (&dst)[2]) {
-    dst[0] = { .start = 0_phys, .end = 0_phys };
-    dst[1] = { .start = 0_phys, .end = 0_phys };
+    dst[0] = { .start = 0_phys, .end = 0_phys, .node = a.node };
+    dst[1] = { .start = 0_phys, .end = 0_phys, .node = a.node };
 
     if (a.start < b.start) {
       // +-----+---+-----+---+-----+
@@ -79,6 +84,8 @@ namespace {
 
   __init_data size_t memory_region_count;
 
+  __init_data uint32_t memory_node;
+
   __init_data region_t device_region[CONFIG_MAX_DEVICE_REGIONS];
 
   __init_data size_t device_region_count;
@@ -173,8 +180,8 @@ namespace {
       panic("Too many memory regions");
     }
 
-    logd(tag, "Memory region: %p - %p", region.start, region.end);
-    memory_region[memory_region_count++] = region;
+    logd(tag, "Memory region: %p - %p (node %u)", region.start, region.end, memory_node);
+    memory_region[memory_region_count++] = { region.start, region.end, memory_node };
   }
 
   __init_code void push_device_region(const region_t region) {
@@ -217,7 +224,7 @@ namespace {
 
       if (region.start.raw() & (1ull << size_bit)) {
         if (size >= (1ull << size_bit)) {
-          capability_t cap = make_memory_cap(device, 1ull << size_bit, region.start.as<void>());
+          capability_t cap = make_memory_cap(device, 1ull << size_bit, region.start.as<void>(), region.node);
           logd(tag, "Memory capability created. addr=%p, size=%p(2^%-2d), type=%s", region.start, 1ull << size_bit, size_bit, device ? "device" : "memory");
 
           map_ptr<cap_slot_t> cap_slot = insert_cap(root_task, cap);
@@ -239,7 +246,7 @@ namespace {
       size_t size = region.end - region.start;
 
       if (size >= (1ull << size_bit)) {
-        capability_t cap = make_memory_cap(device, 1ull << size_bit, region.start.as<void>());
+        capability_t cap = make_memory_cap(device, 1ull << size_bit, region.start.as<void>(), region.node);
         logd(tag, "Memory capability created. addr=%p, size=%p(2^%-2d), type=%s", region.start, 1ull << size_bit, size_bit, device ? "device" : "memory");
 
         map_ptr<cap_slot_t> cap_slot = insert_cap(root_task, cap);
@@ -256,6 +263,27 @@ namespace {
   }
 } // namespace
 
+__init_code void setup_arch(map_ptr<boot_info_t> boot_info) {
+  assert(boot_info != nullptr);
+
+  setup_isa_extensions(boot_info->dtb);
+  setup_mem_ops();
+  setup_numa(boot_info->dtb);
+  setup_arch_hart();
+}
+
+// FWFT features are per hart, so every hart runs this while it is brought up.
+__init_code void setup_arch_hart() {
+  // Let the hart update the accessed and dirty bits. Otherwise they are set by the page fault handler.
+  // The firmware may have locked the feature, so a failed set is fine if it is already enabled.
+  if (has_isa_ext(isa_ext_t::svadu) && sbi_fwft_set(SBI_FWFT_PTE_AD_HW_UPDATING, 1, 0).error != 0) {
+    sbiret_t ret = sbi_fwft_get(SBI_FWFT_PTE_AD_HW_UPDATING);
+    if (ret.error != 0 || ret.value != 1) {
+      logw(tag, "Failed to enable hardware updating of accessed and dirty bits.");
+    }
+  }
+}
+
 __init_code void setup_memory_capabilities(map_ptr<boot_info_t> boot_info) {
   assert(boot_info != nullptr);
 
@@ -308,6 +336,15 @@ __init_code void setup_memory_capabilities(map_ptr<boot_info_t> boot_info) {
       if (strncmp("mmode_resv", node->name, 10) == 0) {
         for_each_reg(node, prop, push_reserved_region);
       } else if (strcmp("memory", node->name) == 0) {
+        // "numa-node-id" may follow "reg", so look it up before pushing the regions.
+        memory_node = 0;
+        for_each_dtb_prop(node, []([[maybe_unused]] map_ptr<dtb_node_t> node, map_ptr<dtb_prop_t> prop) {
+          if (strcmp(prop->name, "numa-node-id") == 0) {
+            memory_node = to_numa_node(prop->u32);
+            return false;
+          }
+          return true;
+        });
         for_each_reg(node, prop, push_memory_region);
       } else {
         for_each_reg(node, prop, push_device_region);
@@ -348,10 +385,14 @@ __init_code void setup_arch_root_boot_info(map_ptr<boot_info_t> boot_info) {
   root_boot_info->arch_info.num_dtb_vp_caps    = 0;
   root_boot_info->arch_info.dtb_vp_caps_offset = root_boot_info->virt_page_caps_offset + root_boot_info->num_virt_page_caps;
 
-  map_ptr<page_table_t> page_table   = boot_info->payload_page_tables[KILO_PAGE_TABLE_LEVEL];
-  size_t                dtb_size     = end - start;
-  size_t                payload_size = _payload_end - _payload_start;
-  virt_ptr<void>        va_base      = make_virt_ptr(CONFIG_ROOT_TASK_PAYLOAD_BASE_ADDRESS + payload_size);
+  size_t         dtb_size     = end - start;
+  size_t         payload_size = _payload_end - _payload_start;
+  virt_ptr<void> va_base      = make_virt_ptr(CONFIG_ROOT_TASK_PAYLOAD_BASE_ADDRESS + payload_size);
+
+  // The payload may use megapages, so take the kilo page table that holds its last pages.
+  map_ptr<pte_t> mega_pte = boot_info->payload_page_tables[MEGA_PAGE_TABLE_LEVEL]->walk(va_base, MEGA_PAGE_TABLE_LEVEL);
+  assert(mega_pte->is_table());
+  map_ptr<page_table_t> page_table = mega_pte->get_next_page().as<page_table_t>();
 
   for (uintptr_t va_offset = 0; va_offset < dtb_size; va_offset += PAGE_SIZE) {
     map_ptr<void> page = (start + va_offset).as_map();
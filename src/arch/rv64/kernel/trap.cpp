@@ -1,8 +1,12 @@
 #include <cstdint>
 
 #include <kernel/arch/csr.h>
+#include <kernel/arch/sbi.h>
+#include <kernel/cap.h>
 #include <kernel/cls.h>
+#include <kernel/ipc.h>
 #include <kernel/log.h>
+#include <kernel/rcu.h>
 #include <kernel/syscall.h>
 #include <kernel/task.h>
 #include <kernel/trap.h>
@@ -10,13 +14,63 @@
 
 namespace {
   constexpr const char* tag = "kernel/trap";
+
+  bool handle_interrupt(uint64_t code) {
+    switch (code) {
+      case SCAUSE_SUPERVISOR_SOFTWARE_INTERRUPT:
+        asm volatile("csrc sip, %0" : : "r"(SIP_SSIP));
+        get_cls()->need_resched = true;
+        return true;
+      case SCAUSE_SUPERVISOR_TIMER_INTERRUPT:
+        sbi_set_timer(-1);
+        get_cls()->need_resched = true;
+        return true;
+      case SCAUSE_SUPERVISOR_EXTERNAL_INTERRUPT:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool get_fault_access(uint64_t code, fault_access_t& access) {
+    switch (code) {
+      case SCAUSE_INSTRUCTION_PAGE_FAULT:
+        access = fault_access_t::execute;
+        return true;
+      case SCAUSE_LOAD_PAGE_FAULT:
+        access = fault_access_t::read;
+        return true;
+      case SCAUSE_STORE_AMO_PAGE_FAULT:
+        access = fault_access_t::write;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  void handle_need_resched() {
+    map_ptr<core_local_storage_t> cls = get_cls();
+    if (cls->need_resched) [[unlikely]] {
+      cls->need_resched = false;
+      yield();
+    }
+  }
 } // namespace
 
 extern "C" {
   // Defined in src/arch/rv64/kernel/trap.S
   [[noreturn]] void _return_to_user_mode(frame_t*);
 
-  [[noreturn]] void _kernel_trap() {
+  void _kernel_trap() {
+    uint64_t scause;
+    asm volatile("csrr %0, scause" : "=r"(scause));
+
+    // Interrupts are only taken inside preemption windows, so the handler must not take any lock.
+    if ((scause & SCAUSE_INTERRUPT) && handle_interrupt(scause & SCAUSE_EXCEPTION_CODE)) [[likely]] {
+      return;
+    }
+
+    logd(tag, "scause: %p", scause);
     panic("Kernel trap!");
   }
 
@@ -28,8 +82,7 @@ extern "C" {
 
     if (scause & SCAUSE_INTERRUPT) {
       logd(tag, "scause-interrupt: %p", scause & SCAUSE_EXCEPTION_CODE);
-      if ((scause & SCAUSE_EXCEPTION_CODE) == SCAUSE_SUPERVISOR_EXTERNAL_INTERRUPT) {
-      } else {
+      if (!handle_interrupt(scause & SCAUSE_EXCEPTION_CODE)) [[unlikely]] {
         panic("User trap! tid=0x%x", cur_task->tid);
       }
     } else {
@@ -37,20 +90,49 @@ extern "C" {
         enable_trap();
 
         sysret_t sysret = invoke_syscall();
-        if (sysret.error != SYS_S_OK) [[unlikely]] {
-          loge(tag, "Syscall error: %s (%ld)", sysret_error_to_str(sysret.error), sysret.error);
+
+        map_ptr<core_local_storage_t> cls = get_cls();
+        if (cls->restart_syscall) {
+          // The syscall made partial progress. Leave sepc and the arguments untouched so that the ecall is executed again after pending interrupts are handled.
+          cls->restart_syscall = false;
+        } else {
+          if (sysret.error != SYS_S_OK) [[unlikely]] {
+            loge(tag, "Syscall error: %s (%ld)", sysret_error_to_str(sysret.error), sysret.error);
+          }
+
+          map_ptr<task_t>& task = cls->current_task;
+          task->frame.a0        = sysret.result;
+          task->frame.a1        = sysret.error;
+          task->frame.sepc += 4;
         }
+      } else if (fault_access_t access; get_fault_access(scause & SCAUSE_EXCEPTION_CODE, access)) {
+        uint64_t stval;
+        asm volatile("csrr %0, stval" : "=r"(stval));
+
+        enable_trap();
 
-        map_ptr<task_t>& task = get_cls()->current_task;
-        task->frame.a0        = sysret.result;
-        task->frame.a1        = sysret.error;
-        task->frame.sepc += 4;
+        if (set_accessed_dirty(cur_task, make_virt_ptr(stval), access == fault_access_t::write)) {
+          // The access is retried with the accessed and dirty bits set.
+        } else if (access == fault_access_t::write && copy_on_write(cur_task, make_virt_ptr(stval))) {
+          // The store is retried on the private copy.
+        } else if (cur_task->fault_endpoint != nullptr) {
+          // The task blocks until the pager replies, then retries the faulting instruction.
+          if (!ipc_send_fault(cur_task->fault_endpoint, stval, access, cur_task->frame.sepc)) [[unlikely]] {
+            loge(tag, "Failed to deliver page fault: tid=0x%x, addr=%p", cur_task->tid, stval);
+            kill_task(cur_task, -1);
+          }
+        } else {
+          logd(tag, "scause-exception: %p", scause & SCAUSE_EXCEPTION_CODE);
+          panic("User trap! tid=0x%x", cur_task->tid);
+        }
       } else {
         logd(tag, "scause-exception: %p", scause & SCAUSE_EXCEPTION_CODE);
         panic("User trap! tid=0x%x", cur_task->tid);
       }
     }
 
+    handle_need_resched();
+
     return_to_user_mode();
   }
 }
@@ -58,6 +140,8 @@ extern "C" {
 [[noreturn]] void return_to_user_mode() {
   map_ptr<task_t>& task = get_cls()->current_task;
 
+  rcu_quiescent_state();
+
   uint64_t sstatus;
   asm volatile("csrr %0, sstatus" : "=r"(sstatus));
   sstatus &= ~SSTATUS_SIE;
@@ -92,10 +176,10 @@ void set_trap_handler(void (*handler)()) {
   asm volatile("csrw stvec, %0" : : "r"(handler));
 }
 
+// External interrupts stay masked. Nothing claims them from the interrupt controller yet, so a pending one would be taken again at every interrupt window.
 void enable_trap() {
   uint64_t sie;
   asm volatile("csrr %0, sie" : "=r"(sie));
-  sie |= SIE_SEIE;
   sie |= SIE_STIE;
   sie |= SIE_SSIE;
   asm volatile("csrw sie, %0" : : "r"(sie));
@@ -109,3 +193,31 @@ void disable_trap() {
   sie &= ~SIE_SSIE;
   asm volatile("csrw sie, %0" : : "r"(sie));
 }
+
+uintptr_t irq_save() {
+  uintptr_t sstatus;
+  asm volatile("csrrc %0, sstatus, %1" : "=r"(sstatus) : "r"(SSTATUS_SIE) : "memory");
+  return sstatus & SSTATUS_SIE;
+}
+
+void irq_restore(uintptr_t flags) {
+  if (flags & SSTATUS_SIE) {
+    asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_SIE) : "memory");
+  }
+}
+
+void irq_enable() {
+  asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_SIE) : "memory");
+}
+
+void irq_disable() {
+  asm volatile("csrc sstatus, %0" : : "r"(SSTATUS_SIE) : "memory");
+}
+
+bool irq_pending() {
+  uint64_t sip;
+  uint64_t sie;
+  asm volatile("csrr %0, sip" : "=r"(sip));
+  asm volatile("csrr %0, sie" : "=r"(sie));
+  return (sip & sie) != 0;
+}
@@ -0,0 +1,172 @@
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/isa.h>
+#include <kernel/log.h>
+#include <kernel/mem_ops.h>
+
+namespace {
+  constexpr const char* tag = "arch/mem_ops";
+
+  // Vector instructions are emitted as raw encodings so that the kernel does not have to be built with V enabled.
+  constexpr uint64_t SSTATUS_VS_INITIAL = SSTATUS_FS_VS_XS_INITIAL << std::countr_zero(SSTATUS_VS);
+
+  size_t cboz_block_size;
+  size_t cbom_block_size;
+
+  void zero_memory_u64(void* dst, size_t size) {
+    uintptr_t ptr = reinterpret_cast<uintptr_t>(dst);
+    if ((ptr | size) % 64 != 0) [[unlikely]] {
+      memset(dst, 0, size);
+      return;
+    }
+
+    // Written in asm so that the compiler does not turn the loop back into a memset call.
+    for (uintptr_t end = ptr + size; ptr < end; ptr += 64) {
+      asm volatile(
+          "sd zero, 0(%0)\n"
+          "sd zero, 8(%0)\n"
+          "sd zero, 16(%0)\n"
+          "sd zero, 24(%0)\n"
+          "sd zero, 32(%0)\n"
+          "sd zero, 40(%0)\n"
+          "sd zero, 48(%0)\n"
+          "sd zero, 56(%0)\n"
+          :
+          : "r"(ptr)
+          : "memory");
+    }
+  }
+
+  void zero_memory_cboz(void* dst, size_t size) {
+    uintptr_t ptr = reinterpret_cast<uintptr_t>(dst);
+    if ((ptr | size) % cboz_block_size != 0) [[unlikely]] {
+      zero_memory_u64(dst, size);
+      return;
+    }
+
+    for (uintptr_t end = ptr + size; ptr < end; ptr += cboz_block_size) {
+      register uintptr_t a0 asm("a0") = ptr;
+      // cbo.zero (a0)
+      asm volatile(".4byte 0x0045200f" : : "r"(a0) : "memory");
+    }
+  }
+
+  void zero_memory_rvv(void* dst, size_t size) {
+    register void*  a0 asm("a0") = dst;
+    register size_t a1 asm("a1") = size;
+
+    asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_VS_INITIAL));
+    asm volatile(
+        ".4byte 0x0c3072d7\n" // vsetvli t0, zero, e8, m8, ta, ma
+        ".4byte 0x5e003057\n" // vmv.v.i v0, 0
+        "1:\n"
+        ".4byte 0x0c35f2d7\n" // vsetvli t0, a1, e8, m8, ta, ma
+        ".4byte 0x02050027\n" // vse8.v v0, (a0)
+        "add a0, a0, t0\n"
+        "sub a1, a1, t0\n"
+        "bnez a1, 1b\n"
+        : "+r"(a0), "+r"(a1)
+        :
+        : "t0", "memory");
+    asm volatile("csrc sstatus, %0" : : "r"(SSTATUS_VS));
+  }
+
+  void copy_memory_u64(void* dst, const void* src, size_t size) {
+    uintptr_t d = reinterpret_cast<uintptr_t>(dst);
+    uintptr_t s = reinterpret_cast<uintptr_t>(src);
+    if ((d | s | size) % 64 != 0) [[unlikely]] {
+      memcpy(dst, src, size);
+      return;
+    }
+
+    for (uintptr_t end = s + size; s < end; s += 64, d += 64) {
+      asm volatile(
+          "ld t0, 0(%1)\n"
+          "ld t1, 8(%1)\n"
+          "ld t2, 16(%1)\n"
+          "ld t3, 24(%1)\n"
+          "sd t0, 0(%0)\n"
+          "sd t1, 8(%0)\n"
+          "sd t2, 16(%0)\n"
+          "sd t3, 24(%0)\n"
+          "ld t0, 32(%1)\n"
+          "ld t1, 40(%1)\n"
+          "ld t2, 48(%1)\n"
+          "ld t3, 56(%1)\n"
+          "sd t0, 32(%0)\n"
+          "sd t1, 40(%0)\n"
+          "sd t2, 48(%0)\n"
+          "sd t3, 56(%0)\n"
+          :
+          : "r"(d), "r"(s)
+          : "t0", "t1", "t2", "t3", "memory");
+    }
+  }
+
+  void copy_memory_rvv(void* dst, const void* src, size_t size) {
+    register void*       a0 asm("a0") = dst;
+    register const void* a1 asm("a1") = src;
+    register size_t      a2 asm("a2") = size;
+
+    asm volatile("csrs sstatus, %0" : : "r"(SSTATUS_VS_INITIAL));
+    asm volatile(
+        "beqz a2, 2f\n"
+        "1:\n"
+        ".4byte 0x0c3672d7\n" // vsetvli t0, a2, e8, m8, ta, ma
+        ".4byte 0x02058007\n" // vle8.v v0, (a1)
+        ".4byte 0x02050027\n" // vse8.v v0, (a0)
+        "add a0, a0, t0\n"
+        "add a1, a1, t0\n"
+        "sub a2, a2, t0\n"
+        "bnez a2, 1b\n"
+        "2:\n"
+        : "+r"(a0), "+r"(a1), "+r"(a2)
+        :
+        : "t0", "memory");
+    asm volatile("csrc sstatus, %0" : : "r"(SSTATUS_VS));
+  }
+
+  void (*zero_memory_impl)(void*, size_t)              = zero_memory_u64;
+  void (*copy_memory_impl)(void*, const void*, size_t) = copy_memory_u64;
+} // namespace
+
+__init_code void setup_mem_ops() {
+  cboz_block_size = get_cboz_block_size();
+  cbom_block_size = has_isa_ext(isa_ext_t::zicbom) ? get_cbom_block_size() : 0;
+
+  if (has_isa_ext(isa_ext_t::zicboz) && cboz_block_size != 0) {
+    zero_memory_impl = zero_memory_cboz;
+    logi(tag, "Zeroing pages with cbo.zero. (block size=%d)", cboz_block_size);
+  } else if (has_isa_ext(isa_ext_t::v)) {
+    zero_memory_impl = zero_memory_rvv;
+    logi(tag, "Zeroing pages with vector stores.");
+  }
+
+  if (has_isa_ext(isa_ext_t::v)) {
+    copy_memory_impl = copy_memory_rvv;
+    logi(tag, "Copying memory with vector loads and stores.");
+  }
+}
+
+void zero_memory(void* dst, size_t size) {
+  zero_memory_impl(dst, size);
+}
+
+void copy_memory(void* dst, const void* src, size_t size) {
+  copy_memory_impl(dst, src, size);
+}
+
+void flush_memory(void* dst, size_t size) {
+  if (cbom_block_size != 0) {
+    uintptr_t end = reinterpret_cast<uintptr_t>(dst) + size;
+    for (uintptr_t ptr = reinterpret_cast<uintptr_t>(dst) & ~(cbom_block_size - 1); ptr < end; ptr += cbom_block_size) {
+      register uintptr_t a0 asm("a0") = ptr;
+      // cbo.flush (a0)
+      asm volatile(".4byte 0x0025200f" : : "r"(a0) : "memory");
+    }
+  }
+  asm volatile("fence rw, rw" : : : "memory");
+}
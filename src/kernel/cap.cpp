@@ -1,8 +1,9 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cerrno>
-#include <cstring>
 #include <iterator>
-#include <limits>
 #include <mutex>
 
 #include <kernel/align.h>
@@ -12,39 +13,417 @@
 #include <kernel/ipc.h>
 #include <kernel/lock.h>
 #include <kernel/log.h>
+#include <kernel/mem_ops.h>
+#include <kernel/rcu.h>
 #include <kernel/task.h>
+#include <kernel/zero_pool.h>
 #include <libcaprese/syscall.h>
 
 namespace {
   constexpr const char* tag = "kernel/cap";
 
-  spinlock_t id_cap_lock;
-  uint64_t   next_id[3];
-} // namespace
+  std::atomic<uint64_t> next_id_block;
+
+  // Granules freed together, which become reusable once the epoch has expired.
+  struct retire_batch_t {
+    uint64_t epoch;
+    size_t   size;
+  };
+
+  // Header of the bitmap allocator, kept at the start of the memory cap.
+  // A freed object stays marked as used until a grace period has passed, because lock-free readers may still see it.
+  // Frees go to the open batch. It is closed only when the closed batch is empty, so the epoch of a closed batch never moves and steady frees cannot starve collection.
+  struct memory_bitmap_t {
+    spinlock_t     lock;
+    retire_batch_t open;
+    retire_batch_t closed;
+    size_t         num_granules;
+    size_t         num_words;
+    uint64_t       words[]; // The used bits followed by the bits of the open batch and the closed batch.
+  };
+
+  map_ptr<memory_bitmap_t> get_memory_bitmap(const capability_t& cap) {
+    return make_phys_ptr(cap.memory.phys_addr);
+  }
+
+  size_t get_memory_bitmap_size(size_t size) {
+    size_t num_words = (size / MEMORY_BITMAP_GRANULE + 63) / 64;
+    return round_up(sizeof(memory_bitmap_t) + sizeof(uint64_t) * num_words * 3, MEMORY_BITMAP_GRANULE);
+  }
+
+  void set_granules(uint64_t* words, size_t first, size_t count) {
+    for (size_t i = first; i < first + count;) {
+      size_t   n    = std::min<size_t>(64 - i % 64, first + count - i);
+      uint64_t mask = (n == 64 ? ~0ull : (1ull << n) - 1) << (i % 64);
+      words[i / 64] |= mask;
+      i             += n;
+    }
+  }
 
-capability_t make_unique_id_cap() {
-  std::lock_guard lock(id_cap_lock);
+  // Returns first + count if all granules in the range are free. Otherwise returns the last used granule in the range.
+  size_t find_last_used_granule(const uint64_t* words, size_t first, size_t count) {
+    size_t result = first + count;
+    for (size_t i = first; i < first + count;) {
+      size_t   n    = std::min<size_t>(64 - i % 64, first + count - i);
+      uint64_t mask = (n == 64 ? ~0ull : (1ull << n) - 1) << (i % 64);
+      uint64_t used = words[i / 64] & mask;
+      if (used != 0) {
+        result = i / 64 * 64 + 63 - std::countl_zero(used);
+      }
+      i += n;
+    }
+    return result;
+  }
+
+  void collect_closed_batch(capability_t& cap, map_ptr<memory_bitmap_t> bitmap) {
+    if (bitmap->closed.epoch == 0 || !rcu_is_expired(bitmap->closed.epoch)) {
+      return;
+    }
 
-  uint64_t val1 = next_id[0];
-  uint64_t val2 = next_id[1];
-  uint64_t val3 = next_id[2];
+    uint64_t* closed = bitmap->words + bitmap->num_words * 2;
+    for (size_t i = 0; i < bitmap->num_words; ++i) {
+      bitmap->words[i] &= ~closed[i];
+      closed[i]         = 0;
+    }
 
-  if (next_id[2] == std::numeric_limits<uint64_t>::max()) [[unlikely]] {
-    if (next_id[1] == std::numeric_limits<uint64_t>::max()) [[unlikely]] {
-      ++next_id[0];
-      next_id[1] = 0;
-    } else {
-      ++next_id[1];
+    cap.memory.used_size -= bitmap->closed.size;
+    bitmap->closed        = {};
+  }
+
+  void collect_retired_granules(capability_t& cap, map_ptr<memory_bitmap_t> bitmap) {
+    collect_closed_batch(cap, bitmap);
+
+    if (bitmap->closed.epoch != 0 || bitmap->open.epoch == 0) {
+      return;
     }
-    next_id[2] = 0;
-  } else {
-    ++next_id[2];
+
+    uint64_t* open   = bitmap->words + bitmap->num_words;
+    uint64_t* closed = open + bitmap->num_words;
+    for (size_t i = 0; i < bitmap->num_words; ++i) {
+      closed[i] = open[i];
+      open[i]   = 0;
+    }
+
+    bitmap->closed = bitmap->open;
+    bitmap->open   = {};
+
+    collect_closed_batch(cap, bitmap);
+  }
+
+  // First fit over the bitmap. Alignment padding is left free, so it can be used by later objects.
+  uintptr_t alloc_memory_bitmap(capability_t& cap, size_t size, size_t alignment) {
+    map_ptr<memory_bitmap_t> bitmap = get_memory_bitmap(cap);
+
+    std::lock_guard lock(bitmap->lock);
+
+    collect_retired_granules(cap, bitmap);
+
+    uintptr_t base  = cap.memory.phys_addr;
+    size_t    align = std::max(alignment, MEMORY_BITMAP_GRANULE);
+    size_t    count = round_up(size, MEMORY_BITMAP_GRANULE) / MEMORY_BITMAP_GRANULE;
+
+    for (size_t i = (round_up(base, align) - base) / MEMORY_BITMAP_GRANULE; i + count <= bitmap->num_granules;) {
+      size_t last_used = find_last_used_granule(bitmap->words, i, count);
+      if (last_used == i + count) {
+        set_granules(bitmap->words, i, count);
+        cap.memory.used_size += count * MEMORY_BITMAP_GRANULE;
+        return base + i * MEMORY_BITMAP_GRANULE;
+      }
+      i = (round_up(base + (last_used + 1) * MEMORY_BITMAP_GRANULE, align) - base) / MEMORY_BITMAP_GRANULE;
+    }
+
+    return 0;
+  }
+
+  // Returns false for objects whose memory cannot be reused.
+  bool get_object_memory(capability_t cap, uintptr_t& phys_addr, size_t& size) {
+    switch (get_cap_type(cap)) {
+      case CAP_MEM:
+        phys_addr = cap.memory.phys_addr;
+        size      = cap.memory.size;
+        return true;
+      case CAP_ENDPOINT:
+        phys_addr = cap.endpoint.endpoint.as_phys().raw();
+        size      = get_cap_size(CAP_ENDPOINT);
+        return true;
+      case CAP_PAGE_TABLE:
+        phys_addr = cap.page_table.table.as_phys().raw();
+        size      = get_cap_size(CAP_PAGE_TABLE);
+        return true;
+      case CAP_VIRT_PAGE:
+        phys_addr = cap.virt_page.phys_addr;
+        size      = get_page_size(cap.virt_page.level);
+        return true;
+      case CAP_CAP_SPACE:
+        // A cap space that could not be released stays mapped.
+        if (cap.cap_space.used && cap.cap_space.space->meta_info.retire_epoch == 0) {
+          return false;
+        }
+        phys_addr = cap.cap_space.space.as_phys().raw();
+        size      = cap.cap_space.mega ? get_page_size(MEGA_PAGE_TABLE_LEVEL) : get_cap_size(CAP_CAP_SPACE);
+        return true;
+      default:
+        // A killed task is still referenced by its cap spaces, so its page is never reused.
+        return false;
+    }
+  }
+
+  // A NAPOT entry holds the base of its range, so the page of the entry is found from its place in the range.
+  map_ptr<void> get_entry_page(pte_t& pte, size_t index) {
+    if (pte.n) {
+      return pte.get_next_page() + (index % NAPOT_PAGE_COUNT) * PAGE_SIZE;
+    }
+    return pte.get_next_page();
+  }
+
+  bool check_unmap_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot) {
+    assert(page_table_slot != nullptr);
+    assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+
+    if (index >= NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. index must be less than %llu. (index=%llu)", NUM_PAGE_TABLE_ENTRY, index);
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    if (virt_page_slot == nullptr) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. virt_page_slot must not be null.");
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    if (get_cap_type(virt_page_slot->cap) != CAP_VIRT_PAGE) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. virt_page_slot must be virt page cap.");
+      errno = SYS_E_CAP_TYPE;
+      return false;
+    }
+
+    auto& page_table_cap = page_table_slot->cap.page_table;
+    auto& virt_page_cap  = virt_page_slot->cap.virt_page;
+
+    uintptr_t va = page_table_cap.virt_addr_base + get_page_size(virt_page_cap.level) * index;
+    if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. Virtual address must be less than %p. (index=%llu, addr=%p, level=%d)", CONFIG_KERNEL_SPACE_BASE, index, va, (int)virt_page_cap.level);
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    pte_t& pte = page_table_cap.table->entries[index];
+    if (pte.is_disabled()) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. Page table entry must be enabled. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+
+    if (!virt_page_cap.mapped) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. Virt page cap must be mapped. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+      errno = SYS_E_CAP_STATE;
+      return false;
+    }
+
+    // Derived caps share the physical page, so the entry may belong to another cap of the same page.
+    if (virt_page_cap.parent_table != page_table_cap.table || virt_page_cap.index != index) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. Virt page cap is mapped at another place. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    map_ptr<void> map_ptr = make_phys_ptr(virt_page_cap.phys_addr);
+
+    if (get_entry_page(pte, index) != map_ptr) [[unlikely]] {
+      logd(tag, "Failed to unmap virt page. virt_page_cap is not mapped to the page table entry. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+
+    return true;
+  }
+
+  // The parent is the nearest preceding slot that is shallower. Copies and zombies of the object are siblings.
+  map_ptr<cap_slot_t> find_parent_slot(map_ptr<cap_slot_t> slot) {
+    map_ptr<cap_slot_t> parent = slot->prev;
+    while (parent != nullptr && parent->depth >= slot->depth) {
+      parent = parent->prev;
+    }
+    return parent;
+  }
+
+  // The hardware may set the bits concurrently, so they are cleared with the same atomicity.
+  void take_accessed_dirty(pte_t& entry, bool clear, bool& accessed, bool& dirty) {
+    std::atomic_ref<pte_t> pte(entry);
+    pte_t                  old_pte = pte.load(std::memory_order_relaxed);
+
+    if (clear && (old_pte.a || old_pte.d)) {
+      pte_t new_pte;
+      do {
+        new_pte   = old_pte;
+        new_pte.a = 0;
+        new_pte.d = 0;
+      } while (!pte.compare_exchange_weak(old_pte, new_pte, std::memory_order_relaxed));
+    }
+
+    accessed = accessed || old_pte.a;
+    dirty    = dirty || old_pte.d;
+  }
+
+  map_ptr<cap_slot_t> find_mapped_virt_page_cap(map_ptr<task_t> task, map_ptr<page_table_t> page_table, size_t index) {
+    for (map_ptr<cap_space_t> cap_space = task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+      for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+        auto& cap = cap_space->slots[i].cap;
+        if (get_cap_type(cap) == CAP_VIRT_PAGE && cap.virt_page.mapped && cap.virt_page.parent_table == page_table && cap.virt_page.index == index) {
+          return make_map_ptr(&cap_space->slots[i]);
+        }
+      }
+    }
+
+    return 0_map;
+  }
+
+  // A page is shared through a derived cap in the destination task, so it stays allocated while a clone maps it and is unmapped from the clone when the source cap is revoked.
+  bool clone_page(map_ptr<task_t> dst_task, map_ptr<cap_slot_t> mem_slot, map_ptr<cap_slot_t> src_slot) {
+    auto&          src_cap = src_slot->cap.virt_page;
+    virt_ptr<void> va      = src_cap.address;
+
+    map_ptr<page_table_t> page_table = dst_task->root_page_table;
+    for (size_t l = MAX_PAGE_TABLE_LEVEL; l > src_cap.level; --l) {
+      map_ptr<pte_t> pte = page_table->walk(va, l);
+
+      if (pte->is_disabled()) {
+        map_ptr<cap_slot_t> slot = pop_free_slots(dst_task);
+        if (slot == nullptr) [[unlikely]] {
+          logd(tag, "Failed to clone page. No more free slots.");
+          errno = SYS_E_OUT_OF_CAP_SPACE;
+          return false;
+        }
+
+        if (create_page_table_object(slot, mem_slot) == nullptr) [[unlikely]] {
+          push_free_slots(dst_task, slot);
+          return false;
+        }
+
+        auto& page_table_cap = slot->cap.page_table;
+
+        pte->set_flags({});
+        pte->set_next_page(page_table_cap.table.as<void>());
+        pte->enable();
+
+        page_table_cap.mapped         = true;
+        page_table_cap.level          = l - 1;
+        page_table_cap.virt_addr_base = round_down(va.raw(), get_page_size(l));
+        page_table_cap.parent_table   = page_table;
+      }
+
+      // The tables mirror those of the source task, so a leaf never sits above another leaf.
+      assert(pte->is_table());
+      page_table = pte->get_next_page().as<page_table_t>();
+    }
+
+    capability_t cap           = src_slot->cap;
+    cap.virt_page.zeroed       = 0;
+    cap.virt_page.derived      = 1;
+    cap.virt_page.read_only    = 1;
+    cap.virt_page.parent_table = page_table;
+
+    map_ptr<cap_slot_t> slot = insert_cap(dst_task, cap);
+    if (slot == nullptr) [[unlikely]] {
+      logd(tag, "Failed to clone page. No more free slots.");
+      return false;
+    }
+    src_slot->insert_child(slot);
+
+    // The source entry may be part of a NAPOT range, so the page number is taken from the cap.
+    pte_t& dst_pte = page_table->entries[src_cap.index];
+    assert(dst_pte.is_disabled());
+
+    dst_pte     = src_cap.parent_table->entries[src_cap.index];
+    dst_pte.n   = 0;
+    dst_pte.cow = dst_pte.cow || dst_pte.w;
+    dst_pte.w   = 0;
+    dst_pte.set_next_page(make_phys_ptr(src_cap.phys_addr));
+
+    return true;
+  }
+
+  // A page is shared while a cap derived from it or the cap it was derived from still holds it. A delegated parent is left as a zombie, which still counts.
+  bool is_shared_page(map_ptr<cap_slot_t> slot) {
+    if (slot->has_children()) {
+      return true;
+    }
+
+    if (!slot->cap.virt_page.derived) {
+      return false;
+    }
+
+    map_ptr<cap_slot_t> parent = find_parent_slot(slot);
+    return parent != nullptr && get_cap_type(parent->cap) != CAP_MEM;
+  }
+
+  bool is_clonable_page(const capability_t& cap) {
+    return get_cap_type(cap) == CAP_VIRT_PAGE && cap.virt_page.mapped && !cap.virt_page.device && cap.virt_page.address < CONFIG_KERNEL_SPACE_BASE;
+  }
+
+  // Returns whether table is the page table at level on the walk of va from root.
+  bool is_table_on_walk(map_ptr<page_table_t> root, virt_ptr<void> va, size_t level, map_ptr<page_table_t> table) {
+    map_ptr<page_table_t> page_table = root;
+    for (size_t l = MAX_PAGE_TABLE_LEVEL; l > level; --l) {
+      map_ptr<pte_t> pte = page_table->walk(va, l);
+      if (!pte->is_table()) {
+        return false;
+      }
+      page_table = pte->get_next_page().as<page_table_t>();
+    }
+    return page_table == table;
+  }
+
+  // The user space of the destination was empty, so every cap mapped into it was made by the clone. Leaves go first, then the tables from the bottom up.
+  void undo_clone(map_ptr<task_t> dst_task) {
+    map_ptr<page_table_t> root = dst_task->root_page_table;
+
+    for (size_t level = KILO_PAGE_TABLE_LEVEL; level < MAX_PAGE_TABLE_LEVEL; ++level) {
+      for (map_ptr<cap_space_t> cap_space = dst_task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+        for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+          map_ptr<cap_slot_t> slot = make_map_ptr(&cap_space->slots[i]);
+          auto&               cap  = slot->cap;
+
+          bool cloned = false;
+          if (level == KILO_PAGE_TABLE_LEVEL && get_cap_type(cap) == CAP_VIRT_PAGE && cap.virt_page.mapped) {
+            cloned = is_table_on_walk(root, cap.virt_page.address, cap.virt_page.level, cap.virt_page.parent_table);
+          } else if (get_cap_type(cap) == CAP_PAGE_TABLE && cap.page_table.mapped && cap.page_table.level == level) {
+            cloned = is_table_on_walk(root, make_virt_ptr(cap.page_table.virt_addr_base), level + 1, cap.page_table.parent_table);
+          }
+
+          if (cloned) {
+            [[maybe_unused]] bool destroyed = destroy_cap(slot);
+            assert(destroyed);
+          }
+        }
+      }
+    }
+  }
+} // namespace
+
+capability_t make_unique_id_cap() {
+  id_block_t& id_block = get_cls()->id_block;
+
+  if (!id_block.valid || id_block.offset == (1ull << ID_BLOCK_SIZE_BIT)) [[unlikely]] {
+    id_block.block  = next_id_block.fetch_add(1, std::memory_order_relaxed);
+    id_block.offset = 0;
+    id_block.valid  = true;
   }
 
-  return make_id_cap(val1, val2, val3);
+  // The block number and the offset in it form an 80-bit id spread over val2 and val3.
+  uint64_t val2 = id_block.block >> (64 - ID_BLOCK_SIZE_BIT);
+  uint64_t val3 = (id_block.block << ID_BLOCK_SIZE_BIT) | id_block.offset++;
+
+  return make_id_cap(0, val2, val3);
 }
 
 map_ptr<cap_slot_t> create_memory_object(map_ptr<cap_slot_t> dst, map_ptr<cap_slot_t> src, size_t size, size_t alignment) {
+  bool zeroed;
+  return create_memory_object(dst, src, size, alignment, zeroed);
+}
+
+map_ptr<cap_slot_t> create_memory_object(map_ptr<cap_slot_t> dst, map_ptr<cap_slot_t> src, size_t size, size_t alignment, bool& zeroed) {
   assert(src != nullptr);
   assert(get_cap_type(src->cap) == CAP_MEM);
   assert(dst != nullptr);
@@ -58,18 +437,30 @@ map_ptr<cap_slot_t> create_memory_object(map_ptr<cap_slot_t> dst, map_ptr<cap_sl
     return 0_map;
   }
 
-  uintptr_t base_addr = round_up(mem_cap.phys_addr + mem_cap.used_size, alignment);
-  size_t    rem_size  = mem_cap.phys_addr + mem_cap.size - base_addr;
+  uintptr_t base_addr;
+  if (static_cast<mem_allocator_t>(mem_cap.allocator) == mem_allocator_t::bitmap) {
+    base_addr = alloc_memory_bitmap(src->cap, size, alignment);
+    if (base_addr == 0) [[unlikely]] {
+      logd(tag, "Failed to create memory object. Not enough memory.");
+      errno = SYS_E_CAP_STATE;
+      return 0_map;
+    }
+  } else {
+    base_addr       = round_up(mem_cap.phys_addr + mem_cap.used_size, alignment);
+    size_t rem_size = mem_cap.phys_addr + mem_cap.size - base_addr;
 
-  if (rem_size < size) [[unlikely]] {
-    logd(tag, "Failed to create memory object. Not enough memory.");
-    errno = SYS_E_CAP_STATE;
-    return 0_map;
+    if (rem_size < size) [[unlikely]] {
+      logd(tag, "Failed to create memory object. Not enough memory.");
+      errno = SYS_E_CAP_STATE;
+      return 0_map;
+    }
+
+    mem_cap.used_size = base_addr + size - mem_cap.phys_addr;
   }
 
-  dst->cap          = make_memory_cap(mem_cap.device, size, make_phys_ptr(base_addr));
-  mem_cap.used_size = base_addr + size - mem_cap.phys_addr;
-  src->insert_after(dst);
+  zeroed   = take_zeroed_range(mem_cap.phys_addr, mem_cap.size, base_addr, size);
+  dst->cap = make_memory_cap(mem_cap.device, size, make_phys_ptr(base_addr), mem_cap.node);
+  src->insert_child(dst);
 
   return dst;
 }
@@ -118,14 +509,17 @@ map_ptr<cap_slot_t> create_task_object(map_ptr<cap_slot_t> dst,
     cap_space_page_tables[i] = cap_space_page_table_slots[i]->cap.page_table.table;
   }
 
-  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE);
+  bool zeroed;
+  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE, zeroed);
   if (dst == nullptr) [[unlikely]] {
     logd(tag, "Failed to create task object. This is due to the failure to create a memory object.");
     return 0_map;
   }
 
   map_ptr<task_t> task = make_phys_ptr(dst->cap.memory.phys_addr);
-  memset(task.get(), 0, sizeof(task_t));
+  if (!zeroed) {
+    zero_memory(task.get(), sizeof(task_t));
+  }
 
   init_task(task, cap_space, root_page_table, cap_space_page_tables);
 
@@ -158,14 +552,17 @@ map_ptr<cap_slot_t> create_endpoint_object(map_ptr<cap_slot_t> dst, map_ptr<cap_
     return 0_map;
   }
 
-  dst = create_memory_object(dst, src, get_cap_size(CAP_ENDPOINT), get_cap_size(CAP_ENDPOINT));
+  bool zeroed;
+  dst = create_memory_object(dst, src, get_cap_size(CAP_ENDPOINT), get_cap_size(CAP_ENDPOINT), zeroed);
   if (dst == nullptr) [[unlikely]] {
     logd(tag, "Failed to create endpoint object. This is due to the failure to create a memory object.");
     return 0_map;
   }
 
   map_ptr<endpoint_t> endpoint = make_phys_ptr(dst->cap.memory.phys_addr);
-  memset(endpoint.get(), 0, sizeof(endpoint_t));
+  if (!zeroed) {
+    zero_memory(endpoint.get(), sizeof(endpoint_t));
+  }
 
   dst->cap = make_endpoint_cap(endpoint);
 
@@ -185,14 +582,17 @@ map_ptr<cap_slot_t> create_page_table_object(map_ptr<cap_slot_t> dst, map_ptr<ca
     return 0_map;
   }
 
-  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE);
+  bool zeroed;
+  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE, zeroed);
   if (dst == nullptr) [[unlikely]] {
     logd(tag, "Failed to create page table object. This is due to the failure to create a memory object.");
     return 0_map;
   }
 
   map_ptr<page_table_t> page_table = make_phys_ptr(dst->cap.memory.phys_addr);
-  memset(page_table.get(), 0, sizeof(page_table_t));
+  if (!zeroed) {
+    zero_memory(page_table.get(), sizeof(page_table_t));
+  }
 
   dst->cap = make_page_table_cap(page_table, false, 0, 0_virt, 0_map);
 
@@ -212,13 +612,15 @@ map_ptr<cap_slot_t> create_virt_page_object(map_ptr<cap_slot_t> dst, map_ptr<cap
   }
 
   size_t page_size = get_page_size(level);
-  dst              = create_memory_object(dst, src, page_size, page_size);
+  bool   zeroed;
+  dst = create_memory_object(dst, src, page_size, page_size, zeroed);
   if (dst == nullptr) [[unlikely]] {
     logd(tag, "Failed to create virt page object. This is due to the failure to create a memory object.");
     return 0_map;
   }
 
-  dst->cap = make_virt_page_cap(dst->cap.memory.device, readable, writable, executable, false, level, make_phys_ptr(dst->cap.memory.phys_addr), 0_virt, 0_map);
+  dst->cap                  = make_virt_page_cap(dst->cap.memory.device, readable, writable, executable, false, level, make_phys_ptr(dst->cap.memory.phys_addr), 0_virt, 0_map);
+  dst->cap.virt_page.zeroed = zeroed;
 
   return dst;
 }
@@ -236,16 +638,19 @@ map_ptr<cap_slot_t> create_cap_space_object(map_ptr<cap_slot_t> dst, map_ptr<cap
     return 0_map;
   }
 
-  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE);
+  bool zeroed;
+  dst = create_memory_object(dst, src, PAGE_SIZE, PAGE_SIZE, zeroed);
   if (dst == nullptr) [[unlikely]] {
     logd(tag, "Failed to create cap space object. This is due to the failure to create a memory object.");
     return 0_map;
   }
 
   map_ptr<cap_space_t> cap_space = make_phys_ptr(dst->cap.memory.phys_addr);
-  memset(cap_space.get(), 0, sizeof(cap_space_t));
+  if (!zeroed) {
+    zero_memory(cap_space.get(), sizeof(cap_space_t));
+  }
 
-  dst->cap = make_cap_space_cap(cap_space, false);
+  dst->cap = make_cap_space_cap(cap_space, false, false);
 
   return dst;
 }
@@ -277,6 +682,12 @@ map_ptr<cap_slot_t> create_object(map_ptr<task_t> task, map_ptr<cap_slot_t> cap_
     return 0_map;
   }
 
+  if (cap_slot->cap.memory.revoking) [[unlikely]] {
+    logd(tag, "Failed to create object. The memory cap is being revoked.");
+    errno = SYS_E_ILL_STATE;
+    return 0_map;
+  }
+
   map_ptr<cap_slot_t> slot = pop_free_slots(task);
   if (slot == nullptr) [[unlikely]] {
     logd(tag, "Failed to create object. No more free slots.");
@@ -380,18 +791,124 @@ map_ptr<cap_slot_t> create_object(map_ptr<task_t> task, map_ptr<cap_slot_t> cap_
   return result;
 }
 
+map_ptr<cap_slot_t> create_objects(map_ptr<task_t> task, map_ptr<cap_slot_t> cap_slot, cap_type_t type, size_t count, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+  assert(task == get_cls()->current_task);
+  assert(cap_slot != nullptr);
+
+  if (get_cap_type(cap_slot->cap) != CAP_MEM) [[unlikely]] {
+    logd(tag, "Failed to create objects. cap_slot must be memory cap.");
+    errno = SYS_E_CAP_TYPE;
+    return 0_map;
+  }
+
+  if (count == 0 || count > NUM_SLOTS_PER_CAP_SPACE) [[unlikely]] {
+    logd(tag, "Failed to create objects. count must be in 1..%llu. (count=%llu)", NUM_SLOTS_PER_CAP_SPACE, count);
+    errno = SYS_E_ILL_ARGS;
+    return 0_map;
+  }
+
+  // Tasks need their own cap space and page tables, and id objects do not come from memory.
+  if (type != CAP_MEM && type != CAP_ENDPOINT && type != CAP_PAGE_TABLE && type != CAP_VIRT_PAGE && type != CAP_CAP_SPACE) [[unlikely]] {
+    logd(tag, "Failed to create objects. This type cannot be created in a batch. (type=%d)", type);
+    errno = SYS_E_ILL_ARGS;
+    return 0_map;
+  }
+
+  std::lock_guard lock(task->lock);
+
+  if (task->state == task_state_t::unused || task->state == task_state_t::killed) [[unlikely]] {
+    logd(tag, "Failed to create objects. The task is not running.");
+    errno = SYS_E_ILL_STATE;
+    return 0_map;
+  }
+
+  if (cap_slot->cap.memory.revoking) [[unlikely]] {
+    logd(tag, "Failed to create objects. The memory cap is being revoked.");
+    errno = SYS_E_ILL_STATE;
+    return 0_map;
+  }
+
+  map_ptr<cap_slot_t> slots = take_fresh_slots(task, count);
+  if (slots == nullptr) [[unlikely]] {
+    logd(tag, "Failed to create objects. No cap space has %llu unused slots in a row.", count);
+    errno = SYS_E_OUT_OF_CAP_SPACE;
+    return 0_map;
+  }
+
+  size_t used_size = cap_slot->cap.memory.used_size;
+  size_t created   = 0;
+
+  for (; created < count; ++created) {
+    map_ptr<cap_slot_t> slot   = make_map_ptr(&slots[created]);
+    map_ptr<cap_slot_t> result = 0_map;
+
+    switch (type) {
+      case CAP_MEM:
+        result = create_memory_object(slot, cap_slot, arg0, arg1);
+        break;
+      case CAP_ENDPOINT:
+        result = create_endpoint_object(slot, cap_slot);
+        break;
+      case CAP_PAGE_TABLE:
+        result = create_page_table_object(slot, cap_slot);
+        break;
+      case CAP_VIRT_PAGE:
+        result = create_virt_page_object(slot, cap_slot, arg0, arg1, arg2, arg3);
+        break;
+      case CAP_CAP_SPACE:
+        result = create_cap_space_object(slot, cap_slot);
+        break;
+      default:
+        panic("Unexpected cap type.");
+    }
+
+    if (result == nullptr) [[unlikely]] {
+      break;
+    }
+
+    preempt_point();
+  }
+
+  // Either all objects are created or none. The new objects are fresh and unmapped, so giving back their memory is enough.
+  if (created < count) [[unlikely]] {
+    int error = errno;
+
+    for (size_t i = 0; i < count; ++i) {
+      map_ptr<cap_slot_t> slot = make_map_ptr(&slots[i]);
+      if (i < created) {
+        reclaim_object_memory(slot);
+      }
+      push_free_slots(task, slot);
+    }
+
+    if (static_cast<mem_allocator_t>(cap_slot->cap.memory.allocator) == mem_allocator_t::bump) {
+      cap_slot->cap.memory.used_size = used_size;
+    }
+
+    errno = error;
+    return 0_map;
+  }
+
+  return slots;
+}
+
 bool is_same_object(map_ptr<cap_slot_t> lhs, map_ptr<cap_slot_t> rhs) {
   assert(lhs != nullptr);
   assert(rhs != nullptr);
 
-  while (get_cap_type(lhs->cap) == CAP_ZOMBIE) {
+  // Callers may not hold the lock, so a zombie chain can be cut concurrently.
+  while (lhs != nullptr && get_cap_type(lhs->cap) == CAP_ZOMBIE) {
     lhs = lhs->next;
   }
 
-  while (get_cap_type(rhs->cap) == CAP_ZOMBIE) {
+  while (rhs != nullptr && get_cap_type(rhs->cap) == CAP_ZOMBIE) {
     rhs = rhs->next;
   }
 
+  if (lhs == nullptr || rhs == nullptr) [[unlikely]] {
+    return false;
+  }
+
   // If it's not copyable, it should point to the same address.
   if (lhs == rhs) {
     return true;
@@ -416,9 +933,118 @@ bool is_same_object(map_ptr<cap_slot_t> lhs, map_ptr<cap_slot_t> rhs) {
   }
 }
 
+bool set_memory_allocator(map_ptr<cap_slot_t> slot, mem_allocator_t allocator) {
+  assert(slot != nullptr);
+  assert(get_cap_type(slot->cap) == CAP_MEM);
+
+  auto& mem_cap = slot->cap.memory;
+
+  if (allocator != mem_allocator_t::bump && allocator != mem_allocator_t::bitmap) [[unlikely]] {
+    logd(tag, "Failed to set memory allocator. Unknown allocator: %d", static_cast<int>(allocator));
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (mem_cap.revoking || slot->has_children()) [[unlikely]] {
+    logd(tag, "Failed to set memory allocator. The memory cap must have no children.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  if (static_cast<mem_allocator_t>(mem_cap.allocator) == allocator) {
+    return true;
+  }
+
+  if (allocator == mem_allocator_t::bump) {
+    map_ptr<memory_bitmap_t> bitmap = get_memory_bitmap(slot->cap);
+    collect_retired_granules(slot->cap, bitmap);
+
+    if (bitmap->open.size != 0 || bitmap->closed.size != 0) [[unlikely]] {
+      logd(tag, "Failed to set memory allocator. Objects freed recently are still in a grace period.");
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+
+    mem_cap.allocator = static_cast<uint64_t>(mem_allocator_t::bump);
+    mem_cap.used_size = 0;
+    return true;
+  }
+
+  // The bitmap is kept in the memory itself, so device memory cannot use it.
+  size_t bitmap_size = get_memory_bitmap_size(mem_cap.size);
+  if (mem_cap.device || mem_cap.phys_addr % MEMORY_BITMAP_GRANULE != 0 || mem_cap.size <= bitmap_size) [[unlikely]] {
+    logd(tag, "Failed to set memory allocator. The memory cap cannot hold a bitmap.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  // The zero pool only tracks bump allocation.
+  remove_zero_pool_region(mem_cap.phys_addr, mem_cap.size);
+
+  map_ptr<memory_bitmap_t> bitmap = get_memory_bitmap(slot->cap);
+  zero_memory(bitmap.get(), bitmap_size);
+  bitmap->num_granules = mem_cap.size / MEMORY_BITMAP_GRANULE;
+  bitmap->num_words    = (bitmap->num_granules + 63) / 64;
+  set_granules(bitmap->words, 0, bitmap_size / MEMORY_BITMAP_GRANULE);
+
+  mem_cap.allocator = static_cast<uint64_t>(mem_allocator_t::bitmap);
+  mem_cap.used_size = bitmap_size;
+
+  return true;
+}
+
+bool set_memory_prezero(map_ptr<cap_slot_t> slot) {
+  assert(slot != nullptr);
+  assert(get_cap_type(slot->cap) == CAP_MEM);
+
+  auto& mem_cap = slot->cap.memory;
+
+  if (mem_cap.device || mem_cap.revoking || static_cast<mem_allocator_t>(mem_cap.allocator) != mem_allocator_t::bump) [[unlikely]] {
+    logd(tag, "Failed to set memory prezero. The memory cap must be normal memory with the bump allocator.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  if (!add_zero_pool_region(mem_cap.phys_addr, mem_cap.size, mem_cap.phys_addr + mem_cap.used_size)) [[unlikely]] {
+    logd(tag, "Failed to set memory prezero. The zero pool is full.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  return true;
+}
+
+void reclaim_object_memory(map_ptr<cap_slot_t> slot) {
+  assert(slot != nullptr);
+
+  uintptr_t phys_addr;
+  size_t    size;
+  if (slot->depth == 0 || !get_object_memory(slot->cap, phys_addr, size)) {
+    return;
+  }
+
+  map_ptr<cap_slot_t> parent = find_parent_slot(slot);
+  if (parent == nullptr || get_cap_type(parent->cap) != CAP_MEM || static_cast<mem_allocator_t>(parent->cap.memory.allocator) != mem_allocator_t::bitmap) {
+    return;
+  }
+
+  map_ptr<memory_bitmap_t> bitmap = get_memory_bitmap(parent->cap);
+
+  std::lock_guard lock(bitmap->lock);
+
+  size_t first = (phys_addr - parent->cap.memory.phys_addr) / MEMORY_BITMAP_GRANULE;
+  size_t count = round_up(size, MEMORY_BITMAP_GRANULE) / MEMORY_BITMAP_GRANULE;
+  assert(first + count <= bitmap->num_granules);
+
+  set_granules(bitmap->words + bitmap->num_words, first, count);
+  bitmap->open.size  += count * MEMORY_BITMAP_GRANULE;
+  bitmap->open.epoch  = rcu_retire_epoch();
+}
+
 void destroy_memory_object(map_ptr<cap_slot_t> slot) {
-  assert(slot->is_tail());
+  assert(!slot->has_children());
   assert(get_cap_type(slot->cap) == CAP_MEM);
+  remove_zero_pool_region(slot->cap.memory.phys_addr, slot->cap.memory.size);
   slot->cap.memory.used_size = 0;
 }
 
@@ -432,6 +1058,8 @@ void destroy_endpoint_object(map_ptr<cap_slot_t> slot) {
   assert(slot->is_tail() || !is_same_object(slot, slot->next));
   assert(get_cap_type(slot->cap) == CAP_ENDPOINT);
   ipc_cancel(slot->cap.endpoint.endpoint);
+  // The endpoint memory may be reused, so no task may keep it as its kill notify or fault endpoint.
+  clear_endpoint_refs(slot->cap.endpoint.endpoint);
 }
 
 void destroy_page_table_object(map_ptr<cap_slot_t> slot) {
@@ -453,6 +1081,7 @@ void destroy_virt_page_object(map_ptr<cap_slot_t> slot) {
 
   map_ptr<page_table_t> parent_table = slot->cap.virt_page.parent_table;
   if (parent_table != nullptr) {
+    parent_table->split_napot(slot->cap.virt_page.index);
     map_ptr<pte_t> pte = parent_table->walk(slot->cap.virt_page.address, slot->cap.virt_page.level);
     assert(pte->is_enabled());
     assert(pte->get_next_page() == phys_ptr<void>::from(slot->cap.virt_page.phys_addr).as_map());
@@ -460,11 +1089,18 @@ void destroy_virt_page_object(map_ptr<cap_slot_t> slot) {
   }
 }
 
-void destroy_cap_space_object([[maybe_unused]] map_ptr<cap_slot_t> slot) {
+void destroy_cap_space_object(map_ptr<cap_slot_t> slot) {
   assert(slot->is_tail() || !is_same_object(slot, slot->next));
   assert(get_cap_type(slot->cap) == CAP_CAP_SPACE);
 
-  // TODO: impl
+  auto& cap_space_cap = slot->cap.cap_space;
+  if (!cap_space_cap.used) {
+    return;
+  }
+
+  if (!release_cap_space(cap_space_cap.space, cap_space_cap.mega)) [[unlikely]] {
+    logw(tag, "The cap space is still in use. It stays mapped until the task is killed.");
+  }
 }
 
 void destroy_id_object([[maybe_unused]] map_ptr<cap_slot_t> slot) {
@@ -596,7 +1232,8 @@ bool unmap_page_table_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map
   return true;
 }
 
-bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot, bool readable, bool writable, bool executable) {
+bool map_virt_page_cap(
+    map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> virt_page_slot, bool readable, bool writable, bool executable, mem_type_t mem_type, bool tracked) {
   assert(page_table_slot != nullptr);
   assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
 
@@ -612,8 +1249,14 @@ bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_pt
     return false;
   }
 
-  if (get_cap_type(virt_page_slot->cap) != CAP_VIRT_PAGE) [[unlikely]] {
-    logd(tag, "Failed to map virt page. virt_page_slot must be virt page cap.");
+  if (mem_type > mem_type_t::io) [[unlikely]] {
+    logd(tag, "Failed to map virt page. Unknown memory type. (mem_type=%d)", static_cast<int>(mem_type));
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (get_cap_type(virt_page_slot->cap) != CAP_VIRT_PAGE) [[unlikely]] {
+    logd(tag, "Failed to map virt page. virt_page_slot must be virt page cap.");
     errno = SYS_E_CAP_TYPE;
     return false;
   }
@@ -647,8 +1290,21 @@ bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_pt
     return false;
   }
 
-  if (!virt_page_cap.device) {
-    memset(phys_ptr<void>::from(virt_page_cap.phys_addr).as_map().get(), 0, get_page_size(virt_page_cap.level));
+  if (writable && virt_page_cap.read_only) [[unlikely]] {
+    logd(tag, "Failed to map virt page. Read-only virt page cap cannot be mapped writable. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  // A page carved from a pre-zeroed range is clean only until its first mapping. A page shared through derived caps keeps its contents, since copy_cap has zeroed it if no cap was using it.
+  if (!virt_page_cap.device && !virt_page_cap.zeroed && !virt_page_cap.derived && !virt_page_slot->has_children()) {
+    zero_memory(phys_ptr<void>::from(virt_page_cap.phys_addr).as_map().get(), get_page_size(virt_page_cap.level));
+  }
+  virt_page_cap.zeroed = 0;
+
+  // Dirty lines left by the cacheable kernel mapping must not be written back over an uncached view of the page.
+  if (!virt_page_cap.device && mem_type != mem_type_t::pma) {
+    flush_memory(phys_ptr<void>::from(virt_page_cap.phys_addr).as_map().get(), get_page_size(virt_page_cap.level));
   }
 
   pte.set_flags({
@@ -658,10 +1314,17 @@ bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_pt
       .user       = true,
       .global     = false,
   });
+  pte.set_mem_type(mem_type);
   pte.set_next_page(make_phys_ptr(virt_page_cap.phys_addr));
+  if (tracked) {
+    pte.a = 0;
+    pte.d = 0;
+  }
   pte.enable();
 
   virt_page_cap.mapped       = true;
+  virt_page_cap.tracked      = tracked;
+  virt_page_cap.mem_type     = static_cast<uint64_t>(mem_type);
   virt_page_cap.readable     = readable;
   virt_page_cap.writable     = writable;
   virt_page_cap.executable   = executable;
@@ -669,6 +1332,10 @@ bool map_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_pt
   virt_page_cap.address      = virt_ptr<void>::from(va);
   virt_page_cap.parent_table = page_table_cap.table;
 
+  if (virt_page_cap.level == KILO_PAGE_TABLE_LEVEL) {
+    page_table_cap.table->merge_napot(index);
+  }
+
   return true;
 }
 
@@ -676,59 +1343,92 @@ bool unmap_virt_page_cap(map_ptr<cap_slot_t> page_table_slot, size_t index, map_
   assert(page_table_slot != nullptr);
   assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
 
-  if (index >= NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. index must be less than %llu. (index=%llu)", NUM_PAGE_TABLE_ENTRY, index);
-    errno = SYS_E_ILL_ARGS;
+  if (!check_unmap_virt_page_cap(page_table_slot, index, virt_page_slot)) [[unlikely]] {
     return false;
   }
 
-  if (virt_page_slot == nullptr) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. virt_page_slot must not be null.");
-    errno = SYS_E_ILL_ARGS;
-    return false;
-  }
+  // The page leaves its NAPOT range, so the other pages of the range go back to separate entries.
+  page_table_slot->cap.page_table.table->split_napot(index);
+  page_table_slot->cap.page_table.table->entries[index].disable();
 
-  if (get_cap_type(virt_page_slot->cap) != CAP_VIRT_PAGE) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. virt_page_slot must be virt page cap.");
-    errno = SYS_E_CAP_TYPE;
-    return false;
-  }
+  auto& virt_page_cap        = virt_page_slot->cap.virt_page;
+  virt_page_cap.mapped       = false;
+  virt_page_cap.parent_table = 0_map;
 
-  auto& page_table_cap = page_table_slot->cap.page_table;
-  auto& virt_page_cap  = virt_page_slot->cap.virt_page;
+  return true;
+}
 
-  uintptr_t va = page_table_cap.virt_addr_base + get_page_size(virt_page_cap.level) * index;
-  if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. Virtual address must be less than %p. (index=%llu, addr=%p, level=%d)", CONFIG_KERNEL_SPACE_BASE, index, va, (int)virt_page_cap.level);
+bool map_virt_page_caps(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, const virt_page_map_entry_t* entries, size_t count) {
+  assert(page_table_slot != nullptr);
+  assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+
+  if (count > VIRT_PAGE_RANGE_MAX_ENTRIES || index + count > NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+    logd(tag, "Failed to map virt pages. The range is out of the page table. (index=%llu, count=%llu)", index, count);
     errno = SYS_E_ILL_ARGS;
     return false;
   }
 
-  pte_t& pte = page_table_cap.table->entries[index];
-  if (pte.is_disabled()) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. Page table entry must be enabled. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
-    errno = SYS_E_ILL_STATE;
-    return false;
+  map_ptr<cap_slot_t> virt_page_slots[VIRT_PAGE_RANGE_MAX_ENTRIES];
+
+  for (size_t i = 0; i < count; ++i) {
+    const uintptr_t flags = entries[i].flags;
+
+    // lookup_cap does not set errno for an empty slot, so a null slot is left to map_virt_page_cap to reject.
+    virt_page_slots[i] = lookup_cap(task, entries[i].virt_page);
+    if (!map_virt_page_cap(page_table_slot,
+                           index + i,
+                           virt_page_slots[i],
+                           flags & VIRT_PAGE_MAP_READABLE,
+                           flags & VIRT_PAGE_MAP_WRITABLE,
+                           flags & VIRT_PAGE_MAP_EXECUTABLE,
+                           static_cast<mem_type_t>((flags >> VIRT_PAGE_MAP_MEM_TYPE_SHIFT) & VIRT_PAGE_MAP_MEM_TYPE_MASK),
+                           flags & VIRT_PAGE_MAP_TRACKED)) [[unlikely]] {
+      // Roll back so that the whole run is either mapped or left untouched.
+      int error = errno;
+      while (i-- > 0) {
+        [[maybe_unused]] bool unmapped = unmap_virt_page_cap(page_table_slot, index + i, virt_page_slots[i]);
+        assert(unmapped);
+      }
+      errno = error;
+      return false;
+    }
+
+    // Zeroing each page can take a while.
+    preempt_point();
   }
 
-  if (!virt_page_cap.mapped) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. Virt page cap must be mapped. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
-    errno = SYS_E_CAP_STATE;
+  return true;
+}
+
+bool unmap_virt_page_caps(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, const uintptr_t* virt_pages, size_t count) {
+  assert(page_table_slot != nullptr);
+  assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+
+  if (count > VIRT_PAGE_RANGE_MAX_ENTRIES || index + count > NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+    logd(tag, "Failed to unmap virt pages. The range is out of the page table. (index=%llu, count=%llu)", index, count);
+    errno = SYS_E_ILL_ARGS;
     return false;
   }
 
-  map_ptr<void> map_ptr = make_phys_ptr(virt_page_cap.phys_addr);
+  map_ptr<cap_slot_t> virt_page_slots[VIRT_PAGE_RANGE_MAX_ENTRIES];
 
-  if (pte.get_next_page() != map_ptr) [[unlikely]] {
-    logd(tag, "Failed to unmap virt page. virt_page_cap is not mapped to the page table entry. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
-    errno = SYS_E_ILL_STATE;
-    return false;
+  // Validate the whole run first, since an unmapped page cannot be restored without zeroing it again.
+  for (size_t i = 0; i < count; ++i) {
+    // lookup_cap does not set errno for an empty slot, so a null slot is left to check_unmap_virt_page_cap to reject.
+    virt_page_slots[i] = lookup_cap(task, virt_pages[i]);
+    if (!check_unmap_virt_page_cap(page_table_slot, index + i, virt_page_slots[i])) [[unlikely]] {
+      return false;
+    }
   }
 
-  pte.disable();
+  for (size_t i = 0; i < count; ++i) {
+    page_table_slot->cap.page_table.table->split_napot(index + i);
+    page_table_slot->cap.page_table.table->entries[index + i].disable();
 
-  virt_page_cap.mapped       = false;
-  virt_page_cap.parent_table = 0_map;
+    auto& virt_page_cap        = virt_page_slots[i]->cap.virt_page;
+    virt_page_cap.mapped       = false;
+    virt_page_cap.parent_table = 0_map;
+  }
 
   return true;
 }
@@ -785,6 +1485,13 @@ bool remap_virt_page_cap(
     return false;
   }
 
+  // Derived caps share the physical page, so the old entry must be the one this cap was mapped with.
+  if (old_page_table_cap.table != virt_page_cap.parent_table) [[unlikely]] {
+    logd(tag, "Failed to remap virt page. Virt page cap is not mapped in old_page_table_cap. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
   if (new_page_table_cap.level != old_page_table_cap.level) [[unlikely]] {
     logd(tag, "Failed to remap virt page. new_page_table_cap and old_page_table_cap must have the same level. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
     errno = SYS_E_CAP_STATE;
@@ -797,6 +1504,12 @@ bool remap_virt_page_cap(
     return false;
   }
 
+  if (writable && virt_page_cap.read_only) [[unlikely]] {
+    logd(tag, "Failed to remap virt page. Read-only virt page cap cannot be mapped writable. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
   pte_t& new_pte = new_page_table_cap.table->entries[index];
   if (new_pte.is_enabled()) [[unlikely]] {
     logd(tag, "Failed to remap virt page. New page table entry must be disabled. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
@@ -813,12 +1526,13 @@ bool remap_virt_page_cap(
 
   map_ptr<void> map_ptr = make_phys_ptr(virt_page_cap.phys_addr);
 
-  if (old_pte.get_next_page() != map_ptr) [[unlikely]] {
+  if (get_entry_page(old_pte, virt_page_cap.index) != map_ptr) [[unlikely]] {
     logd(tag, "Failed to remap virt page. virt_page_cap is not mapped to the page table entry. (index=%llu, addr=%p, level=%d)", index, va, (int)virt_page_cap.level);
     errno = SYS_E_ILL_STATE;
     return false;
   }
 
+  old_page_table_cap.table->split_napot(virt_page_cap.index);
   old_pte.disable();
 
   new_pte.set_flags({
@@ -828,7 +1542,13 @@ bool remap_virt_page_cap(
       .user       = true,
       .global     = false,
   });
+  new_pte.set_mem_type(static_cast<mem_type_t>(virt_page_cap.mem_type));
   new_pte.set_next_page(map_ptr);
+  // A tracked page keeps what was recorded at its old place.
+  if (virt_page_cap.tracked) {
+    new_pte.a = old_pte.a;
+    new_pte.d = old_pte.d;
+  }
   new_pte.enable();
 
   virt_page_cap.readable     = readable;
@@ -838,10 +1558,616 @@ bool remap_virt_page_cap(
   virt_page_cap.address      = virt_ptr<void>::from(new_page_table_cap.virt_addr_base + get_page_size(virt_page_cap.level) * index);
   virt_page_cap.parent_table = new_page_table_cap.table;
 
+  if (virt_page_cap.level == KILO_PAGE_TABLE_LEVEL) {
+    new_page_table_cap.table->merge_napot(index);
+  }
+
   return true;
 }
 
-bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_space_slot) {
+bool set_virt_page_read_only(map_ptr<cap_slot_t> virt_page_slot) {
+  assert(virt_page_slot != nullptr);
+  assert(get_cap_type(virt_page_slot->cap) == CAP_VIRT_PAGE);
+
+  auto& virt_page_cap = virt_page_slot->cap.virt_page;
+
+  if (virt_page_cap.mapped && virt_page_cap.writable) [[unlikely]] {
+    logd(tag, "Failed to make virt page read-only. Virt page cap must not be mapped writable.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  // Caps derived from now on inherit the restriction. Existing ones are not affected.
+  virt_page_cap.read_only = 1;
+
+  return true;
+}
+
+bool scan_accessed_dirty(map_ptr<cap_slot_t> page_table_slot, size_t index, size_t count, uint64_t* accessed, uint64_t* dirty, bool clear) {
+  assert(page_table_slot != nullptr);
+  assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+  assert(accessed != nullptr);
+  assert(dirty != nullptr);
+
+  if (index >= NUM_PAGE_TABLE_ENTRY || count > NUM_PAGE_TABLE_ENTRY - index) [[unlikely]] {
+    logd(tag, "Failed to scan accessed and dirty bits. The range is out of the page table. (index=%llu, count=%llu)", index, count);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  auto& page_table_cap = page_table_slot->cap.page_table;
+
+  uintptr_t va = page_table_cap.virt_addr_base + get_page_size(page_table_cap.level) * (index + count);
+  if (count != 0 && va > CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+    logd(tag, "Failed to scan accessed and dirty bits. Virtual address must be less than %p. (index=%llu, count=%llu)", CONFIG_KERNEL_SPACE_BASE, index, count);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  size_t num_words = (count + 63) / 64;
+  std::fill_n(accessed, num_words, 0);
+  std::fill_n(dirty, num_words, 0);
+
+  size_t napot_first    = NUM_PAGE_TABLE_ENTRY;
+  bool   napot_accessed = false;
+  bool   napot_dirty    = false;
+
+  for (size_t i = 0; i < count; ++i) {
+    pte_t& pte = page_table_cap.table->entries[index + i];
+    if (!pte.is_user()) {
+      continue;
+    }
+
+    bool page_accessed = false;
+    bool page_dirty    = false;
+    if (pte.n) {
+      // The hardware may update the bits of any entry in a NAPOT range, so the range is reported and cleared as a whole.
+      size_t first = (index + i) & ~(NAPOT_PAGE_COUNT - 1);
+      if (first != napot_first) {
+        napot_first    = first;
+        napot_accessed = false;
+        napot_dirty    = false;
+        for (size_t j = first; j < first + NAPOT_PAGE_COUNT; ++j) {
+          take_accessed_dirty(page_table_cap.table->entries[j], clear, napot_accessed, napot_dirty);
+        }
+      }
+      page_accessed = napot_accessed;
+      page_dirty    = napot_dirty;
+    } else {
+      take_accessed_dirty(pte, clear, page_accessed, page_dirty);
+    }
+
+    accessed[i / 64] |= static_cast<uint64_t>(page_accessed) << (i % 64);
+    dirty[i / 64]    |= static_cast<uint64_t>(page_dirty) << (i % 64);
+  }
+
+  return true;
+}
+
+bool set_accessed_dirty(map_ptr<task_t> task, virt_ptr<void> va, bool write) {
+  assert(task != nullptr);
+
+  if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  std::lock_guard lock(task->lock);
+
+  size_t                level      = MAX_PAGE_TABLE_LEVEL;
+  map_ptr<page_table_t> page_table = task->root_page_table;
+  map_ptr<pte_t>        pte        = page_table->walk(va, level);
+  while (pte->is_table() && level > KILO_PAGE_TABLE_LEVEL) {
+    page_table = pte->get_next_page().as<page_table_t>();
+    pte        = page_table->walk(va, --level);
+  }
+
+  if (!pte->is_user() || (write && !pte->w)) {
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  // The hardware may use any entry of a NAPOT range, so the bits are set on all of them.
+  size_t index = get_page_table_index(va, level);
+  size_t first = pte->n ? index & ~(NAPOT_PAGE_COUNT - 1) : index;
+  size_t last  = pte->n ? first + NAPOT_PAGE_COUNT : index + 1;
+
+  // Without hardware updating, the access faults on a clear bit instead. Any other fault is left to the caller.
+  bool updated = false;
+  for (size_t i = first; i < last; ++i) {
+    std::atomic_ref<pte_t> pte_ref(page_table->entries[i]);
+    pte_t                  old_pte = pte_ref.load(std::memory_order_relaxed);
+    pte_t                  new_pte;
+    do {
+      if (old_pte.a && (!write || old_pte.d)) {
+        break;
+      }
+      new_pte   = old_pte;
+      new_pte.a = 1;
+      new_pte.d = old_pte.d || write;
+      updated   = true;
+    } while (!pte_ref.compare_exchange_weak(old_pte, new_pte, std::memory_order_relaxed));
+  }
+
+  if (!updated) {
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  return true;
+}
+
+bool promote_virt_pages(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot) {
+  assert(task != nullptr);
+  assert(page_table_slot != nullptr);
+  assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+
+  if (index >= NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. index must be less than %llu. (index=%llu)", NUM_PAGE_TABLE_ENTRY, index);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (child_page_table_slot == nullptr) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. child_page_table_slot must not be null.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (get_cap_type(child_page_table_slot->cap) != CAP_PAGE_TABLE) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. child_page_table_slot must be page table cap.");
+    errno = SYS_E_CAP_TYPE;
+    return false;
+  }
+
+  std::lock_guard lock(task->lock);
+
+  auto& page_table_cap       = page_table_slot->cap.page_table;
+  auto& child_page_table_cap = child_page_table_slot->cap.page_table;
+  auto  level                = page_table_cap.level;
+
+  uintptr_t va = page_table_cap.virt_addr_base + get_page_size(level) * index;
+  if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. Virtual address must be less than %p. (index=%llu, addr=%p, level=%d)", CONFIG_KERNEL_SPACE_BASE, index, va, (int)level);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  pte_t& pte = page_table_cap.table->entries[index];
+  if (level == KILO_PAGE_TABLE_LEVEL || !child_page_table_cap.mapped || !pte.is_table() || pte.get_next_page() != child_page_table_cap.table.as<void>()) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. child_page_table_cap is not mapped to the page table entry. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  map_ptr<page_table_t> child_table = child_page_table_cap.table;
+  for (size_t i = 0; i < NUM_PAGE_TABLE_ENTRY; i += NAPOT_PAGE_COUNT) {
+    child_table->split_napot(i);
+  }
+
+  pte_t     first_pte = child_table->entries[0];
+  uintptr_t phys_addr = first_pte.get_next_page().as_phys().raw();
+  bool      accessed  = false;
+  bool      dirty     = false;
+
+  // Shared pages are left alone, since their copies on write are made one child page at a time.
+  for (size_t i = 0; i < NUM_PAGE_TABLE_ENTRY; ++i) {
+    pte_t& child_pte = child_table->entries[i];
+    if (!child_pte.is_user() || child_pte.cow || child_pte.r != first_pte.r || child_pte.w != first_pte.w || child_pte.x != first_pte.x
+        || child_pte.pbmt != first_pte.pbmt || child_pte.get_next_page().as_phys().raw() != phys_addr + get_page_size(level - 1) * i) [[unlikely]] {
+      logd(tag, "Failed to promote virt pages. Child pages must be contiguous and mapped with the same flags. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+
+    accessed = accessed || child_pte.a;
+    dirty    = dirty || child_pte.d;
+  }
+
+  if (phys_addr % get_page_size(level) != 0) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. Child pages must be aligned to the page size. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  // The granules of the new page are reclaimed at once, so every child page must come from the same memory cap.
+  map_ptr<cap_slot_t> page_slot = 0_map;
+  map_ptr<cap_slot_t> mem_slot  = 0_map;
+  size_t              num_pages = 0;
+  for (map_ptr<cap_space_t> cap_space = task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      map_ptr<cap_slot_t> slot = make_map_ptr(&cap_space->slots[i]);
+      auto&               cap  = slot->cap;
+      if (get_cap_type(cap) != CAP_VIRT_PAGE || !cap.virt_page.mapped || cap.virt_page.parent_table != child_table) {
+        continue;
+      }
+
+      map_ptr<cap_slot_t> parent = find_parent_slot(slot);
+      if (page_slot == nullptr) {
+        page_slot = slot;
+        mem_slot  = parent;
+      }
+
+      auto& page_cap = page_slot->cap.virt_page;
+      if (cap.virt_page.derived || slot->has_children() || parent != mem_slot || mem_slot == nullptr || get_cap_type(mem_slot->cap) != CAP_MEM || cap.virt_page.device != page_cap.device
+          || cap.virt_page.read_only != page_cap.read_only || cap.virt_page.tracked != page_cap.tracked) [[unlikely]] {
+        logd(tag, "Failed to promote virt pages. Child pages must be original caps from the same memory cap. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+        errno = SYS_E_CAP_STATE;
+        return false;
+      }
+
+      ++num_pages;
+    }
+  }
+
+  if (num_pages != NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+    logd(tag, "Failed to promote virt pages. Every child page must have a virt page cap in the task. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  // A single store swaps the table for the leaf, so the range never reads as unmapped.
+  pte_t new_pte = first_pte;
+  new_pte.set_next_page(make_phys_ptr(phys_addr));
+  new_pte.a = accessed;
+  new_pte.d = dirty;
+  std::atomic_ref<pte_t>(pte).store(new_pte, std::memory_order_release);
+
+  // The other caps are dropped without destroying their objects, since their memory now belongs to the new page.
+  for (map_ptr<cap_space_t> cap_space = task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      map_ptr<cap_slot_t> slot = make_map_ptr(&cap_space->slots[i]);
+      auto&               cap  = slot->cap;
+      if (slot != page_slot && get_cap_type(cap) == CAP_VIRT_PAGE && cap.virt_page.mapped && cap.virt_page.parent_table == child_table) {
+        defer_free_slots(task, slot);
+      }
+    }
+
+    preempt_point();
+  }
+
+  auto& virt_page_cap        = page_slot->cap.virt_page;
+  virt_page_cap.level        = level;
+  virt_page_cap.index        = index;
+  virt_page_cap.phys_addr    = phys_addr;
+  virt_page_cap.address      = virt_ptr<void>::from(va);
+  virt_page_cap.parent_table = page_table_cap.table;
+
+  zero_memory(child_table.get(), sizeof(page_table_t));
+
+  child_page_table_cap.mapped       = false;
+  child_page_table_cap.parent_table = 0_map;
+
+  return true;
+}
+
+bool demote_virt_page(map_ptr<task_t> task, map_ptr<cap_slot_t> page_table_slot, size_t index, map_ptr<cap_slot_t> child_page_table_slot) {
+  assert(task != nullptr);
+  assert(page_table_slot != nullptr);
+  assert(get_cap_type(page_table_slot->cap) == CAP_PAGE_TABLE);
+
+  if (index >= NUM_PAGE_TABLE_ENTRY) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. index must be less than %llu. (index=%llu)", NUM_PAGE_TABLE_ENTRY, index);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (child_page_table_slot == nullptr) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. child_page_table_slot must not be null.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (get_cap_type(child_page_table_slot->cap) != CAP_PAGE_TABLE) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. child_page_table_slot must be page table cap.");
+    errno = SYS_E_CAP_TYPE;
+    return false;
+  }
+
+  std::lock_guard lock(task->lock);
+
+  auto& page_table_cap       = page_table_slot->cap.page_table;
+  auto& child_page_table_cap = child_page_table_slot->cap.page_table;
+  auto  level                = page_table_cap.level;
+
+  uintptr_t va = page_table_cap.virt_addr_base + get_page_size(level) * index;
+  if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. Virtual address must be less than %p. (index=%llu, addr=%p, level=%d)", CONFIG_KERNEL_SPACE_BASE, index, va, (int)level);
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  pte_t& pte = page_table_cap.table->entries[index];
+  if (level == KILO_PAGE_TABLE_LEVEL || !pte.is_user() || pte.cow) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. Page table entry must map a page owned by the task. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (child_page_table_cap.mapped) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. Page table cap must not be mapped. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  map_ptr<page_table_t> child_table = child_page_table_cap.table;
+  for (size_t i = 0; i < NUM_PAGE_TABLE_ENTRY; ++i) {
+    if (child_table->entries[i].is_enabled()) [[unlikely]] {
+      logd(tag, "Failed to demote virt page. Page table cap must be empty. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+  }
+
+  map_ptr<cap_slot_t> page_slot = find_mapped_virt_page_cap(task, page_table_cap.table, index);
+  if (page_slot == nullptr || page_slot->cap.virt_page.derived || page_slot->has_children()) [[unlikely]] {
+    logd(tag, "Failed to demote virt page. The page must have an original virt page cap in the task. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  auto&               virt_page_cap = page_slot->cap.virt_page;
+  pte_t               old_pte       = std::atomic_ref<pte_t>(pte).load(std::memory_order_relaxed);
+  size_t              page_size     = get_page_size(level - 1);
+  map_ptr<cap_slot_t> last_slot     = page_slot;
+
+  // Every slot is taken before the mapping changes, so running out of slots leaves the page as it was.
+  for (size_t i = 1; i < NUM_PAGE_TABLE_ENTRY; ++i) {
+    map_ptr<cap_slot_t> slot = take_free_slot(task);
+    if (slot == nullptr) [[unlikely]] {
+      while (last_slot != page_slot) {
+        map_ptr<cap_slot_t> prev_slot = last_slot->prev;
+        push_free_slots(task, last_slot);
+        last_slot = prev_slot;
+      }
+
+      logd(tag, "Failed to demote virt page. No more free slots. (index=%llu, addr=%p, level=%d)", index, va, (int)level);
+      errno = SYS_E_OUT_OF_CAP_SPACE;
+      return false;
+    }
+
+    slot->cap = make_virt_page_cap(virt_page_cap.device, virt_page_cap.readable, virt_page_cap.writable, virt_page_cap.executable, true, level - 1,
+                                   phys_ptr<void>::from(virt_page_cap.phys_addr + page_size * i), virt_ptr<void>::from(va + page_size * i), child_table);
+    slot->cap.virt_page.read_only = virt_page_cap.read_only;
+    slot->cap.virt_page.tracked   = virt_page_cap.tracked;
+    slot->cap.virt_page.mem_type  = virt_page_cap.mem_type;
+
+    last_slot->insert_after(slot);
+    last_slot = slot;
+  }
+
+  for (size_t i = 0; i < NUM_PAGE_TABLE_ENTRY; ++i) {
+    pte_t child_pte = old_pte;
+    child_pte.set_next_page(make_phys_ptr(virt_page_cap.phys_addr + page_size * i));
+    child_pte.a             = old_pte.a;
+    child_pte.d             = old_pte.d;
+    child_table->entries[i] = child_pte;
+  }
+
+  if (level - 1 == KILO_PAGE_TABLE_LEVEL) {
+    for (size_t i = 0; i < NUM_PAGE_TABLE_ENTRY; i += NAPOT_PAGE_COUNT) {
+      child_table->merge_napot(i);
+    }
+  }
+
+  // A single store swaps the leaf for the table, so the range never reads as unmapped.
+  pte_t new_pte = {};
+  new_pte.set_flags({});
+  new_pte.set_next_page(child_table.as<void>());
+  new_pte.enable();
+  std::atomic_ref<pte_t>(pte).store(new_pte, std::memory_order_release);
+
+  virt_page_cap.level        = level - 1;
+  virt_page_cap.index        = 0;
+  virt_page_cap.parent_table = child_table;
+
+  child_page_table_cap.mapped         = true;
+  child_page_table_cap.level          = level - 1;
+  child_page_table_cap.virt_addr_base = va;
+  child_page_table_cap.parent_table   = page_table_cap.table;
+
+  return true;
+}
+
+bool clone_address_space(map_ptr<task_t> dst_task, map_ptr<task_t> src_task, map_ptr<cap_slot_t> mem_slot) {
+  assert(dst_task != nullptr);
+  assert(src_task != nullptr);
+  assert(mem_slot != nullptr);
+  assert(get_cap_type(mem_slot->cap) == CAP_MEM);
+
+  map_ptr<task_t>& mem_task = mem_slot->get_cap_space()->meta_info.task;
+
+  // The memory cap registered before is replaced, so the task holding it is locked too.
+  map_ptr<cap_slot_t> old_mem_slot = dst_task->cow_memory;
+  map_ptr<task_t>     old_mem_task = old_mem_slot != nullptr ? old_mem_slot->get_cap_space()->meta_info.task : dst_task;
+
+  std::scoped_lock lock { dst_task->lock, src_task->lock, mem_task->lock, old_mem_task->lock };
+
+  if (dst_task == src_task) [[unlikely]] {
+    logd(tag, "Failed to clone address space. The source and destination tasks must be different.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (dst_task->state != task_state_t::suspended || src_task->state != task_state_t::suspended) [[unlikely]] {
+    logd(tag, "Failed to clone address space. Both tasks must be suspended.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (dst_task->cow_memory != old_mem_slot) [[unlikely]] {
+    logd(tag, "Failed to clone address space. The memory cap of the destination task has changed.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  auto& mem_cap = mem_slot->cap.memory;
+  if (mem_cap.device || mem_cap.revoking) [[unlikely]] {
+    logd(tag, "Failed to clone address space. Memory must be normal memory that is not being revoked.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  for (size_t i = 0; i < get_page_table_index(make_virt_ptr(CONFIG_KERNEL_SPACE_BASE), MAX_PAGE_TABLE_LEVEL); ++i) {
+    if (dst_task->root_page_table->entries[i].is_enabled()) [[unlikely]] {
+      logd(tag, "Failed to clone address space. The user space of the destination task must be empty.");
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+  }
+
+  size_t used_size = mem_cap.used_size;
+
+  // The destination is built first and the source is left untouched until nothing can fail. Device pages are left out, since a private copy of them would not reach the device.
+  for (map_ptr<cap_space_t> cap_space = src_task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      map_ptr<cap_slot_t> slot = make_map_ptr(&cap_space->slots[i]);
+      if (!is_clonable_page(slot->cap)) {
+        continue;
+      }
+
+      if (!clone_page(dst_task, mem_slot, slot)) [[unlikely]] {
+        int error = errno;
+        undo_clone(dst_task);
+        if (static_cast<mem_allocator_t>(mem_cap.allocator) == mem_allocator_t::bump) {
+          mem_cap.used_size = used_size;
+        }
+        errno = error;
+        return false;
+      }
+    }
+
+    preempt_point();
+  }
+
+  // A shared page stays read-only for every cap referring to it, so a remapped source cap cannot write under the clones. copy_on_write gives it back once the clones are gone.
+  for (map_ptr<cap_space_t> cap_space = src_task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      auto& cap = cap_space->slots[i].cap;
+      if (!is_clonable_page(cap)) {
+        continue;
+      }
+
+      // The source entry becomes copy-on-write on its own, so it leaves its NAPOT range.
+      auto& virt_page_cap = cap.virt_page;
+      virt_page_cap.parent_table->split_napot(virt_page_cap.index);
+
+      pte_t& pte = virt_page_cap.parent_table->entries[virt_page_cap.index];
+      pte.cow    = pte.cow || pte.w;
+      pte.w      = 0;
+
+      virt_page_cap.read_only = 1;
+    }
+  }
+
+  // Stores to shared pages in either task are served from the same memory.
+  set_cow_memory(dst_task, mem_slot);
+  if (src_task->cow_memory == nullptr) {
+    set_cow_memory(src_task, mem_slot);
+  }
+
+  return true;
+}
+
+bool copy_on_write(map_ptr<task_t> task, virt_ptr<void> va) {
+  assert(task != nullptr);
+
+  if (va >= CONFIG_KERNEL_SPACE_BASE) [[unlikely]] {
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  // A page that is no longer shared is written in place, so the memory cap for copies may be gone.
+  map_ptr<cap_slot_t> mem_slot = task->cow_memory;
+  map_ptr<task_t>     mem_task = mem_slot != nullptr ? mem_slot->get_cap_space()->meta_info.task : task;
+
+  std::scoped_lock lock { task->lock, mem_task->lock };
+
+  // Destroying, delegating or moving the memory cap updates cow_memory under the lock of the task holding it.
+  if (task->cow_memory != mem_slot) [[unlikely]] {
+    logd(tag, "Failed to copy on write. The memory cap for copies has changed. (addr=%p)", va.raw());
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  size_t                level      = MAX_PAGE_TABLE_LEVEL;
+  map_ptr<page_table_t> page_table = task->root_page_table;
+  map_ptr<pte_t>        pte        = page_table->walk(va, level);
+  while (pte->is_table() && level > KILO_PAGE_TABLE_LEVEL) {
+    page_table = pte->get_next_page().as<page_table_t>();
+    pte        = page_table->walk(va, --level);
+  }
+
+  if (!pte->is_user() || !pte->cow) [[unlikely]] {
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  size_t              index      = get_page_table_index(va, level);
+  map_ptr<cap_slot_t> owner_slot = find_mapped_virt_page_cap(task, page_table, index);
+  if (owner_slot == nullptr) [[unlikely]] {
+    logd(tag, "Failed to copy on write. The page is not mapped by a cap of this task. (addr=%p)", va.raw());
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  // The other tasks sharing the page are gone, so the cap gets the page back writable.
+  if (!is_shared_page(owner_slot)) {
+    pte->w   = 1;
+    pte->cow = 0;
+
+    owner_slot->cap.virt_page.read_only = 0;
+
+    return true;
+  }
+
+  if (mem_slot == nullptr) [[unlikely]] {
+    logd(tag, "Failed to copy on write. No memory cap for copies is registered. (addr=%p)", va.raw());
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (mem_slot->cap.memory.revoking) [[unlikely]] {
+    logd(tag, "Failed to copy on write. The memory cap for copies is being revoked. (addr=%p)", va.raw());
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  map_ptr<cap_slot_t> slot = pop_free_slots(task);
+  if (slot == nullptr) [[unlikely]] {
+    logd(tag, "Failed to copy on write. No more free slots. (addr=%p)", va.raw());
+    errno = SYS_E_OUT_OF_CAP_SPACE;
+    return false;
+  }
+
+  if (create_virt_page_object(slot, mem_slot, pte->r, true, pte->x, level) == nullptr) [[unlikely]] {
+    push_free_slots(task, slot);
+    return false;
+  }
+
+  auto& virt_page_cap = slot->cap.virt_page;
+
+  copy_memory(phys_ptr<void>::from(virt_page_cap.phys_addr).as_map().get(), pte->get_next_page().get(), get_page_size(level));
+
+  // The original page stays with its cap, which keeps it allocated for the other tasks sharing it.
+  owner_slot->cap.virt_page.mapped       = false;
+  owner_slot->cap.virt_page.parent_table = 0_map;
+
+  pte->w   = 1;
+  pte->cow = 0;
+  pte->set_next_page(make_phys_ptr(virt_page_cap.phys_addr));
+
+  virt_page_cap.mapped       = true;
+  virt_page_cap.zeroed       = 0;
+  virt_page_cap.mem_type     = pte->pbmt;
+  virt_page_cap.index        = index;
+  virt_page_cap.address      = virt_ptr<void>::from(round_down(va.raw(), get_page_size(level)));
+  virt_page_cap.parent_table = page_table;
+
+  return true;
+}
+
+bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_space_slot, uintptr_t space_index) {
   assert(task_slot != nullptr);
   assert(cap_space_slot != nullptr);
   assert(get_cap_type(task_slot->cap) == CAP_TASK);
@@ -856,13 +2182,31 @@ bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_spa
     return false;
   }
 
-  if (cap_space_cap.used) [[unlikely]] {
+  // A cap space released by compaction can be inserted again once lock-free readers are done with it.
+  map_ptr<cap_space_t> cap_space = cap_space_cap.space;
+  if (cap_space_cap.used && cap_space->meta_info.retire_epoch == 0) [[unlikely]] {
     logd(tag, "Failed to insert cap space. Cap space cap must not be used.");
     errno = SYS_E_CAP_STATE;
     return false;
   }
 
-  if (!insert_cap_space(task_cap.task, cap_space_cap.space)) [[unlikely]] {
+  if (cap_space_cap.used && !rcu_is_expired(cap_space->meta_info.retire_epoch)) [[unlikely]] {
+    logd(tag, "Failed to insert cap space. The cap space was released recently.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (cap_space_cap.mega) {
+    if (!insert_mega_cap_space(task_cap.task, cap_space_cap.space)) [[unlikely]] {
+      return false;
+    }
+  }
+  // space_index is only used in the sparse layout. The dense layout always appends.
+  else if (task_cap.task->cap_layout == cap_layout_t::sparse) {
+    if (!insert_cap_space_at(task_cap.task, cap_space_cap.space, space_index)) [[unlikely]] {
+      return false;
+    }
+  } else if (!insert_cap_space(task_cap.task, cap_space_cap.space)) [[unlikely]] {
     return false;
   }
 
@@ -871,7 +2215,49 @@ bool insert_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> cap_spa
   return true;
 }
 
-bool extend_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> page_table_slot) {
+bool insert_mega_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> mem_slot) {
+  assert(task_slot != nullptr);
+  assert(mem_slot != nullptr);
+  assert(get_cap_type(task_slot->cap) == CAP_TASK);
+  assert(get_cap_type(mem_slot->cap) == CAP_MEM);
+
+  auto& task_cap = task_slot->cap.task;
+  auto& mem_cap  = mem_slot->cap.memory;
+
+  if (task_cap.task->state == task_state_t::unused || task_cap.task->state == task_state_t::killed) [[unlikely]] {
+    logd(tag, "Failed to insert mega cap space. The task is not running.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  constexpr size_t mega_page_size = get_page_size(MEGA_PAGE_TABLE_LEVEL);
+
+  if (mem_cap.device || mem_cap.revoking || mem_cap.used_size != 0 || mem_slot->has_children()) [[unlikely]] {
+    logd(tag, "Failed to insert mega cap space. Memory must be unused normal memory.");
+    errno = SYS_E_CAP_STATE;
+    return false;
+  }
+
+  if (mem_cap.size != mega_page_size || mem_cap.phys_addr % mega_page_size != 0) [[unlikely]] {
+    logd(tag, "Failed to insert mega cap space. Memory must be a single aligned mega page.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  map_ptr<cap_space_t> cap_spaces = make_phys_ptr(mem_cap.phys_addr);
+
+  if (!insert_mega_cap_space(task_cap.task, cap_spaces)) [[unlikely]] {
+    return false;
+  }
+
+  // The memory now belongs to the cap spaces, like a cap space created by create_object.
+  remove_zero_pool_region(mem_cap.phys_addr, mem_cap.size);
+  mem_slot->cap = make_cap_space_cap(cap_spaces, true, true);
+
+  return true;
+}
+
+bool extend_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> page_table_slot, uintptr_t space_index) {
   assert(task_slot != nullptr);
   assert(page_table_slot != nullptr);
   assert(get_cap_type(task_slot->cap) == CAP_TASK);
@@ -892,27 +2278,30 @@ bool extend_cap_space(map_ptr<cap_slot_t> task_slot, map_ptr<cap_slot_t> page_ta
     return false;
   }
 
-  virt_ptr<void> va = extend_cap_space(task_cap.task, page_table_cap.table);
+  // The table is installed into a PTE at this level.
+  size_t         level = MEGA_PAGE_TABLE_LEVEL;
+  virt_ptr<void> va;
+  if (task_cap.task->cap_layout == cap_layout_t::sparse) {
+    va = extend_cap_space_at(task_cap.task, page_table_cap.table, space_index, level);
+  } else {
+    va = extend_cap_space(task_cap.task, page_table_cap.table);
+  }
 
   if (va == nullptr) [[unlikely]] {
     return false;
   }
 
   map_ptr<page_table_t> page_table = task_cap.task->root_page_table;
-  map_ptr<pte_t>        pte        = 0_map;
-  for (size_t level = MAX_PAGE_TABLE_LEVEL; level >= GIGA_PAGE_TABLE_LEVEL; --level) {
-    pte = page_table->walk(va, level);
+  for (size_t l = MAX_PAGE_TABLE_LEVEL; l > level; --l) {
+    map_ptr<pte_t> pte = page_table->walk(va, l);
     assert(pte->is_enabled());
     page_table = pte->get_next_page().as<page_table_t>();
   }
 
-  pte = page_table->walk(va, MEGA_PAGE_TABLE_LEVEL);
-  assert(pte->is_enabled());
-
   page_table_cap.mapped         = true;
-  page_table_cap.level          = KILO_PAGE;
+  page_table_cap.level          = level - 1;
   page_table_cap.virt_addr_base = va.raw();
-  page_table_cap.parent_table   = pte->get_next_page().as<page_table_t>();
+  page_table_cap.parent_table   = page_table;
 
   return true;
 }
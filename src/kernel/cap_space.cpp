@@ -1,7 +1,8 @@
-#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <iterator>
+#include <limits>
 #include <mutex>
 
 #include <kernel/align.h>
@@ -10,6 +11,8 @@
 #include <kernel/cls.h>
 #include <kernel/lock.h>
 #include <kernel/log.h>
+#include <kernel/mem_ops.h>
+#include <kernel/rcu.h>
 #include <kernel/task.h>
 #include <libcaprese/syscall.h>
 
@@ -46,11 +49,13 @@ namespace {
       default:
         panic("Unexcepted cap type.");
     }
+
+    reclaim_object_memory(slot);
   }
 
   void destroy_cap_slot(map_ptr<cap_slot_t> slot) {
     assert(slot != nullptr);
-    assert(slot->is_tail());
+    assert(!slot->has_children());
 
     map_ptr<task_t>& task = slot->get_cap_space()->meta_info.task;
 
@@ -65,19 +70,234 @@ namespace {
       cap_type_t          prev_type = get_cap_type(prev_slot->cap);
 
       // prev_slot is delegated cap.
-      if (prev_type == CAP_ZOMBIE) {
+      if (prev_type == CAP_ZOMBIE && prev_slot->depth == slot->depth) {
         prev_slot->cap = slot->cap;
       }
-      // slot is created by create_object.
-      else if (!is_same_object(prev_slot, slot)) {
+      // slot is the last cap of the object.
+      else if (!is_same_object(prev_slot, slot) && (slot->is_tail() || !is_same_object(slot->next, slot))) {
         destroy_object(slot);
       }
-    } else {
+    } else if (slot->is_tail() || !is_same_object(slot->next, slot)) {
       destroy_object(slot);
     }
 
-    slot->erase_this();
-    push_free_slots(task, slot);
+    defer_free_slots(task, slot);
+  }
+
+  void init_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, uintptr_t space_index) {
+    cap_space->meta_info.map          = cap_space;
+    cap_space->meta_info.task         = task;
+    cap_space->meta_info.space_index  = space_index;
+    cap_space->meta_info.watermark    = 0;
+    cap_space->meta_info.retire_epoch = 0;
+
+    if (space_index == 0) [[unlikely]] {
+      // The first element of cap-space is always null-cap.
+      cap_space->slots[0].cap  = make_null_cap();
+      cap_space->slots[0].next = 0_map;
+      cap_space->slots[0].prev = 0_map;
+      ++cap_space->meta_info.watermark;
+    }
+
+    // Slots above the watermark have never been handed out. pop_free_slots threads them lazily, so a new cap space needs no per-slot work.
+    cap_space->meta_info.next_fresh = task->fresh_cap_spaces;
+    task->fresh_cap_spaces          = cap_space;
+
+    cap_space->meta_info.next = task->cap_spaces;
+    task->cap_spaces          = cap_space;
+
+    task->free_slots_count += std::size(cap_space->slots) - cap_space->meta_info.watermark;
+  }
+
+  map_ptr<pte_t> walk_cap_space(map_ptr<task_t> task, uintptr_t space_index, size_t& level) {
+    virt_ptr<void> va = make_virt_ptr(CONFIG_CAPABILITY_SPACE_BASE + PAGE_SIZE * space_index);
+
+    map_ptr<page_table_t> page_table = task->root_page_table;
+    map_ptr<pte_t>        pte        = 0_map;
+    for (level = MAX_PAGE_TABLE_LEVEL;; --level) {
+      pte = page_table->walk(va, level);
+      if (pte->is_disabled()) [[unlikely]] {
+        return 0_map;
+      }
+
+      // A mega cap space is mapped by a leaf at the mega level.
+      if (level == KILO_PAGE_TABLE_LEVEL || (level == MEGA_PAGE_TABLE_LEVEL && !pte->is_table())) {
+        return pte;
+      }
+
+      page_table = pte->get_next_page().as<page_table_t>();
+    }
+  }
+
+  map_ptr<cap_space_t> get_cap_space_at(map_ptr<task_t> task, uintptr_t space_index) {
+    size_t         level;
+    map_ptr<pte_t> pte = walk_cap_space(task, space_index, level);
+    if (pte == nullptr) [[unlikely]] {
+      return 0_map;
+    }
+
+    map_ptr<cap_space_t> cap_space = pte->get_next_page().as<cap_space_t>();
+    if (level == MEGA_PAGE_TABLE_LEVEL) {
+      cap_space = cap_space + (space_index % CAP_SPACES_PER_MEGA_PAGE);
+    }
+
+    return cap_space;
+  }
+
+  bool is_live_slot(map_ptr<cap_space_t> cap_space, size_t index) {
+    return get_cap_type(cap_space->slots[index].cap) != CAP_NULL;
+  }
+
+  bool is_free_slot(map_ptr<cap_space_t> cap_space, size_t index) {
+    if (cap_space->meta_info.space_index == 0 && index == 0) {
+      return false;
+    }
+    return !is_live_slot(cap_space, index) && cap_space->slots[index].depth != DEFERRED_SLOT_DEPTH;
+  }
+
+  // Slots waiting for a grace period do not count, since the cap space is retired at a later epoch than they were.
+  bool is_empty_cap_space(map_ptr<cap_space_t> cap_space) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      if (is_live_slot(cap_space, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Rebuilds the free list and the fresh list from the slots of cap spaces below limit. Bumping the generation drops every magazine holding slots of
+  // this task, including the ones on other cores, so no free slot is left outside of the lists.
+  void rebuild_free_slots(map_ptr<task_t> task, uintptr_t limit) {
+    ++task->slot_generation;
+
+    map_ptr<cap_slot_t>  free_slots = 0_map;
+    map_ptr<cap_space_t> fresh      = 0_map;
+    size_t               count      = 0;
+
+    for (map_ptr<cap_space_t> cap_space = task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+      if (cap_space->meta_info.space_index >= limit) {
+        continue;
+      }
+
+      for (size_t i = cap_space->meta_info.watermark; i > 0; --i) {
+        if (!is_free_slot(cap_space, i - 1)) {
+          continue;
+        }
+
+        map_ptr<cap_slot_t> slot = make_map_ptr(&cap_space->slots[i - 1]);
+        slot->cap                = make_null_cap();
+        slot->depth              = 0;
+        slot->prev               = 0_map;
+        slot->next               = free_slots;
+        if (free_slots != nullptr) {
+          free_slots->prev = slot;
+        }
+        free_slots = slot;
+        ++count;
+      }
+
+      if (cap_space->meta_info.watermark < std::size(cap_space->slots)) {
+        cap_space->meta_info.next_fresh = fresh;
+        fresh                           = cap_space;
+        count += std::size(cap_space->slots) - cap_space->meta_info.watermark;
+      }
+    }
+
+    task->free_slots       = free_slots;
+    task->fresh_cap_spaces = fresh;
+    task->free_slots_count = count;
+  }
+
+  // Unmaps num cap spaces starting at cap_space. They must be empty, and they stay readable until the retire epoch has expired.
+  void unmap_cap_spaces(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, size_t num) {
+    size_t         level;
+    map_ptr<pte_t> pte = walk_cap_space(task, cap_space->meta_info.space_index, level);
+    assert(pte != nullptr);
+    assert(level == (num == 1 ? KILO_PAGE_TABLE_LEVEL : MEGA_PAGE_TABLE_LEVEL));
+
+    // Lock-free readers that already passed the capacity check or the page walk keep reading valid memory until the grace period has elapsed.
+    task->cap_count.num_cap_space -= num;
+    pte->disable();
+
+    if (level == MEGA_PAGE_TABLE_LEVEL) {
+      --task->cap_count.num_extension;
+
+      // Drop the unmapped indices that padded the previous extension up to the mega cap space.
+      size_t pad_level;
+      while (task->cap_count.num_cap_space > 0 && walk_cap_space(task, task->cap_count.num_cap_space - 1, pad_level) == nullptr) {
+        --task->cap_count.num_cap_space;
+      }
+    }
+
+    auto in_range = [&](map_ptr<cap_slot_t> slot) {
+      map_ptr<cap_space_t> space = slot->get_cap_space();
+      return space >= cap_space && space < cap_space + num;
+    };
+
+    map_ptr<cap_slot_t> prev = 0_map;
+    for (map_ptr<cap_slot_t> slot = task->deferred_slots_head; slot != nullptr; slot = slot->next) {
+      if (!in_range(slot)) {
+        prev = slot;
+        continue;
+      }
+
+      if (prev != nullptr) {
+        prev->next = slot->next;
+      } else {
+        task->deferred_slots_head = slot->next;
+      }
+
+      if (task->deferred_slots_tail == slot) {
+        task->deferred_slots_tail = prev;
+      }
+
+      --task->deferred_slots_count;
+    }
+
+    uint64_t epoch = rcu_retire_epoch();
+    for (size_t i = 0; i < num; ++i) {
+      map_ptr<cap_space_t> target = cap_space + i;
+
+      map_ptr<cap_space_t>* link = &task->cap_spaces;
+      while (*link != target) {
+        link = &(*link)->meta_info.next;
+      }
+      *link = target->meta_info.next;
+
+      target->meta_info.next         = 0_map;
+      target->meta_info.retire_epoch = epoch;
+    }
+  }
+
+  bool revoke_descendants(map_ptr<cap_slot_t> slot, size_t max_count) {
+    assert(get_cap_type(slot->cap) == CAP_MEM || get_cap_type(slot->cap) == CAP_VIRT_PAGE);
+
+    // Destroy the first leaf of the subtree each time. No cursor is kept, so the caller can stop at any point and restart later.
+    for (size_t count = 0; slot->has_children(); ++count) {
+      if (count == max_count) {
+        return false;
+      }
+
+      // A zombie stands in front of its delegated cap, so it is skipped while more of the subtree follows. The walk never leaves the subtree.
+      map_ptr<cap_slot_t> cap_slot = slot->next;
+      while (cap_slot->has_children() || (get_cap_type(cap_slot->cap) == CAP_ZOMBIE && cap_slot->next != nullptr && cap_slot->next->depth > slot->depth)) {
+        cap_slot = cap_slot->next;
+      }
+
+      // A zombie left at the end of the subtree has no object to destroy.
+      if (get_cap_type(cap_slot->cap) == CAP_ZOMBIE) {
+        defer_free_slots(cap_slot->get_cap_space()->meta_info.task, cap_slot);
+      } else {
+        destroy_cap_slot(cap_slot);
+      }
+
+      // A bounded revoke is restarted by its syscall, so it also stops for a pending reschedule.
+      if (preempt_point() && max_count != std::numeric_limits<size_t>::max()) {
+        return !slot->has_children();
+      }
+    }
+
+    return true;
   }
 } // namespace
 
@@ -101,6 +321,18 @@ bool cap_slot_t::is_tail() const {
   return next == nullptr;
 }
 
+bool cap_slot_t::has_children() const {
+  return next != nullptr && next->depth > depth;
+}
+
+map_ptr<cap_slot_t> cap_slot_t::get_last_descendant() {
+  map_ptr<cap_slot_t> slot = make_map_ptr(this);
+  while (slot->next != nullptr && slot->next->depth > depth) {
+    slot = slot->next;
+  }
+  return slot;
+}
+
 void cap_slot_t::insert_before(map_ptr<cap_slot_t> slot) {
   assert(slot != nullptr);
   assert(slot->is_isolated());
@@ -124,7 +356,7 @@ void cap_slot_t::insert_before(map_ptr<cap_slot_t> slot) {
 
 void cap_slot_t::insert_after(map_ptr<cap_slot_t> slot) {
   assert(slot != nullptr);
-  assert(slot->is_head());
+  assert(slot->is_isolated());
 
   map_ptr<task_t>& task = slot->get_cap_space()->meta_info.task;
 
@@ -134,18 +366,20 @@ void cap_slot_t::insert_after(map_ptr<cap_slot_t> slot) {
     panic("Unexpected task state.");
   }
 
-  map_ptr<cap_slot_t> tail = slot;
-  while (!tail->is_tail()) {
-    tail = tail->next;
-  }
-
+  // Inserting right after this slot keeps the children of this slot under it, since the new slot is at the same depth.
   if (this->next != nullptr) {
-    this->next->prev = tail;
-    tail->next       = this->next;
+    this->next->prev = slot;
+    slot->next       = this->next;
   }
 
-  this->next = slot;
-  slot->prev = make_map_ptr(this);
+  this->next  = slot;
+  slot->prev  = make_map_ptr(this);
+  slot->depth = this->depth;
+}
+
+void cap_slot_t::insert_child(map_ptr<cap_slot_t> slot) {
+  insert_after(slot);
+  ++slot->depth;
 }
 
 map_ptr<cap_slot_t> cap_slot_t::erase_this() {
@@ -198,6 +432,8 @@ void cap_slot_t::replace(map_ptr<cap_slot_t> slot) {
     this->next       = slot->next;
     slot->next       = 0_map;
   }
+
+  this->depth = slot->depth;
 }
 
 bool insert_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space) {
@@ -206,7 +442,13 @@ bool insert_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space) {
 
   std::lock_guard lock(task->lock);
 
-  if (task->cap_count.num_cap_space / NUM_PAGE_TABLE_ENTRY > task->cap_count.num_extension) [[unlikely]] {
+  if (task->cap_layout != cap_layout_t::dense) [[unlikely]] {
+    logd(tag, "Failed to insert cap_space. The space index must be specified in the sparse layout.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (task->cap_count.num_cap_space / NUM_PAGE_TABLE_ENTRY >= task->cap_count.num_extension) [[unlikely]] {
     logd(tag, "Failed to insert cap_space. Need to extend space.");
     errno = SYS_E_ILL_STATE;
     return false;
@@ -228,22 +470,64 @@ bool insert_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space) {
   pte->set_flags({ .readable = 1, .writable = 1, .executable = 0, .user = 0, .global = 0 });
   pte->enable();
 
-  auto end = std::rend(cap_space->slots);
-  if (task->cap_count.num_cap_space == 0) [[unlikely]] {
-    // The first element of cap-space is always null-cap.
-    --end;
-    cap_space->slots[0].cap  = make_null_cap();
-    cap_space->slots[0].next = 0_map;
-    cap_space->slots[0].prev = 0_map;
+  init_cap_space(task, cap_space, task->cap_count.num_cap_space);
+
+  // Publish the mapping before the new capacity, which lock-free lookup_cap reads first.
+  std::atomic_thread_fence(std::memory_order_release);
+  ++task->cap_count.num_cap_space;
+
+  return true;
+}
+
+bool insert_mega_cap_space(map_ptr<task_t> task, map_ptr<cap_space_t> cap_spaces) {
+  assert(task != nullptr);
+  assert(cap_spaces != nullptr);
+  assert(cap_spaces.as_phys().raw() % get_page_size(MEGA_PAGE_TABLE_LEVEL) == 0);
+
+  std::lock_guard lock(task->lock);
+
+  if (task->cap_layout != cap_layout_t::dense) [[unlikely]] {
+    logd(tag, "Failed to insert mega cap_space. Only the dense layout is supported.");
+    errno = SYS_E_ILL_STATE;
+    return false;
   }
 
-  cap_space->meta_info.map         = cap_space;
-  cap_space->meta_info.task        = task;
-  cap_space->meta_info.space_index = task->cap_count.num_cap_space;
+  if (task->cap_count.num_extension == NUM_PAGE_TABLE_ENTRY - 1) [[unlikely]] {
+    logd(tag, "Failed to insert mega cap_space. No more extension.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
 
-  std::for_each(std::rbegin(cap_space->slots), end, [task](auto&& slot) { push_free_slots(task, make_map_ptr(&slot)); });
+  // The mega cap space starts the next aligned extension. Unused indices of a partially filled extension are left unmapped, and lookup_cap rejects them.
+  uintptr_t space_index = CAP_SPACES_PER_MEGA_PAGE * task->cap_count.num_extension;
+  assert(task->cap_count.num_cap_space <= space_index);
 
-  ++task->cap_count.num_cap_space;
+  virt_ptr<void> cap_space_base_va = make_virt_ptr(CONFIG_CAPABILITY_SPACE_BASE + PAGE_SIZE * space_index);
+
+  map_ptr<page_table_t> page_table = task->root_page_table;
+  map_ptr<pte_t>        pte        = 0_map;
+  for (size_t level = MAX_PAGE_TABLE_LEVEL; level >= GIGA_PAGE_TABLE_LEVEL; --level) {
+    pte = page_table->walk(cap_space_base_va, level);
+    assert(pte->is_enabled());
+    page_table = pte->get_next_page().as<page_table_t>();
+  }
+
+  pte = page_table->walk(cap_space_base_va, MEGA_PAGE_TABLE_LEVEL);
+  assert(pte->is_disabled());
+  pte->set_next_page(cap_spaces.as<void>());
+  pte->set_flags({ .readable = 1, .writable = 1, .executable = 0, .user = 0, .global = 0 });
+  pte->enable();
+
+  // Push in reverse so that the lowest cap space is handed out first.
+  for (size_t i = CAP_SPACES_PER_MEGA_PAGE; i > 0; --i) {
+    init_cap_space(task, cap_spaces + (i - 1), space_index + (i - 1));
+  }
+
+  ++task->cap_count.num_extension;
+
+  // Publish the mapping before the new capacity, which lock-free lookup_cap reads first.
+  std::atomic_thread_fence(std::memory_order_release);
+  task->cap_count.num_cap_space = space_index + CAP_SPACES_PER_MEGA_PAGE;
 
   return true;
 }
@@ -253,6 +537,12 @@ virt_ptr<void> extend_cap_space(map_ptr<task_t> task, map_ptr<page_table_t> page
 
   std::lock_guard lock(task->lock);
 
+  if (task->cap_layout != cap_layout_t::dense) [[unlikely]] {
+    logd(tag, "Failed to extend cap_space. The space index must be specified in the sparse layout.");
+    errno = SYS_E_ILL_STATE;
+    return 0_virt;
+  }
+
   if (task->cap_count.num_extension == NUM_PAGE_TABLE_ENTRY - 1) [[unlikely]] {
     logd(tag, "Failed to extend cap_space. No more extension.");
     errno = SYS_E_ILL_STATE;
@@ -280,6 +570,277 @@ virt_ptr<void> extend_cap_space(map_ptr<task_t> task, map_ptr<page_table_t> page
   return cap_space_base_va;
 }
 
+bool insert_cap_space_at(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, uintptr_t space_index) {
+  assert(task != nullptr);
+  assert(cap_space != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  if (task->cap_layout != cap_layout_t::sparse) [[unlikely]] {
+    logd(tag, "Failed to insert cap_space. The task does not use the sparse layout.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (space_index >= (1ULL << CAP_DESC_SPACE_BITS)) [[unlikely]] {
+    logd(tag, "Failed to insert cap_space. The space index is out of range.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  virt_ptr<void> cap_space_base_va = make_virt_ptr(CONFIG_CAPABILITY_SPACE_BASE + PAGE_SIZE * space_index);
+
+  map_ptr<page_table_t> page_table = task->root_page_table;
+  map_ptr<pte_t>        pte        = 0_map;
+  for (size_t level = MAX_PAGE_TABLE_LEVEL; level >= MEGA_PAGE_TABLE_LEVEL; --level) {
+    pte = page_table->walk(cap_space_base_va, level);
+    if (pte->is_disabled()) [[unlikely]] {
+      logd(tag, "Failed to insert cap_space. Need to extend space.");
+      errno = SYS_E_ILL_STATE;
+      return false;
+    }
+    page_table = pte->get_next_page().as<page_table_t>();
+  }
+
+  pte = page_table->walk(cap_space_base_va, KILO_PAGE_TABLE_LEVEL);
+  if (pte->is_enabled()) [[unlikely]] {
+    logd(tag, "Failed to insert cap_space. The space index is already in use.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  init_cap_space(task, cap_space, space_index);
+
+  // Lock-free lookup_cap has no capacity check in the sparse layout, so the cap space must be initialized before the PTE becomes valid.
+  pte->set_next_page(cap_space.as<void>());
+  pte->set_flags({ .readable = 1, .writable = 1, .executable = 0, .user = 0, .global = 0 });
+  std::atomic_thread_fence(std::memory_order_release);
+  pte->enable();
+
+  ++task->cap_count.num_cap_space;
+
+  return true;
+}
+
+virt_ptr<void> extend_cap_space_at(map_ptr<task_t> task, map_ptr<page_table_t> page, uintptr_t space_index, size_t& level) {
+  assert(task != nullptr);
+  assert(page != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  if (task->cap_layout != cap_layout_t::sparse) [[unlikely]] {
+    logd(tag, "Failed to extend cap_space. The task does not use the sparse layout.");
+    errno = SYS_E_ILL_STATE;
+    return 0_virt;
+  }
+
+  if (space_index >= (1ULL << CAP_DESC_SPACE_BITS)) [[unlikely]] {
+    logd(tag, "Failed to extend cap_space. The space index is out of range.");
+    errno = SYS_E_ILL_ARGS;
+    return 0_virt;
+  }
+
+  virt_ptr<void> cap_space_base_va = make_virt_ptr(CONFIG_CAPABILITY_SPACE_BASE + PAGE_SIZE * space_index);
+
+  // Only the first missing table on the path to space_index is installed, so sparse ranges need no other intermediate tables.
+  map_ptr<page_table_t> page_table = task->root_page_table;
+  map_ptr<pte_t>        pte        = 0_map;
+  for (level = MAX_PAGE_TABLE_LEVEL; level >= MEGA_PAGE_TABLE_LEVEL; --level) {
+    pte = page_table->walk(cap_space_base_va, level);
+    if (pte->is_disabled()) {
+      break;
+    }
+    page_table = pte->get_next_page().as<page_table_t>();
+  }
+
+  if (level < MEGA_PAGE_TABLE_LEVEL) [[unlikely]] {
+    logd(tag, "Failed to extend cap_space. The path is already populated.");
+    errno = SYS_E_ILL_STATE;
+    return 0_virt;
+  }
+
+  pte->set_flags({});
+  pte->set_next_page(page.as<void>());
+  std::atomic_thread_fence(std::memory_order_release);
+  pte->enable();
+
+  ++task->cap_count.num_extension;
+
+  return make_virt_ptr(round_down(cap_space_base_va.raw(), get_page_size(level)));
+}
+
+bool set_cap_layout(map_ptr<task_t> task, cap_layout_t layout, uintptr_t guard) {
+  assert(task != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  if (layout == task->cap_layout) {
+    if (layout == cap_layout_t::dense || guard == task->cap_guard) {
+      return true;
+    }
+  }
+
+  // Cap space i lives at the same address in both layouts, so switching only changes how descriptors are encoded.
+  // The dense layout requires contiguous cap spaces, so a sparse task cannot go back.
+  if (layout != cap_layout_t::sparse) [[unlikely]] {
+    logd(tag, "Failed to set cap layout. Only switching to the sparse layout is supported.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  if (guard >= (1ULL << (64 - CAP_DESC_RADIX_BITS))) [[unlikely]] {
+    logd(tag, "Failed to set cap layout. The guard is too large.");
+    errno = SYS_E_ILL_ARGS;
+    return false;
+  }
+
+  task->cap_guard  = guard;
+  task->cap_layout = layout;
+
+  return true;
+}
+
+bool compact_cap_space(map_ptr<task_t> task, cap_remap_t* remap, size_t max_count, size_t& count) {
+  assert(task != nullptr);
+  assert(remap != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  count = 0;
+
+  if (task->cap_layout != cap_layout_t::dense) [[unlikely]] {
+    logd(tag, "Failed to compact cap_space. Only the dense layout is supported.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  reclaim_deferred_slots(task);
+
+  size_t num_live = 1;
+  for (map_ptr<cap_space_t> cap_space = task->cap_spaces; cap_space != nullptr; cap_space = cap_space->meta_info.next) {
+    for (size_t i = 0; i < cap_space->meta_info.watermark; ++i) {
+      num_live += is_live_slot(cap_space, i);
+    }
+  }
+
+  uintptr_t num_cap_space = task->cap_count.num_cap_space;
+  uintptr_t target        = (num_live + NUM_SLOTS_PER_CAP_SPACE - 1) / NUM_SLOTS_PER_CAP_SPACE;
+
+  // A mega cap space can only be released as a whole.
+  if (target < num_cap_space && target % CAP_SPACES_PER_MEGA_PAGE != 0) {
+    size_t level;
+    if (walk_cap_space(task, target, level) != nullptr && level == MEGA_PAGE_TABLE_LEVEL) {
+      target = round_up(target, CAP_SPACES_PER_MEGA_PAGE);
+    }
+  }
+
+  if (target < num_cap_space) {
+    // Only slots below target are handed out while moving caps.
+    rebuild_free_slots(task, target);
+
+    for (uintptr_t space_index = num_cap_space; space_index > target && count < max_count; --space_index) {
+      map_ptr<cap_space_t> cap_space = get_cap_space_at(task, space_index - 1);
+      if (cap_space == nullptr) {
+        // Padding below a mega cap space.
+        continue;
+      }
+
+      for (size_t i = 0; i < cap_space->meta_info.watermark && count < max_count; ++i) {
+        if (!is_live_slot(cap_space, i)) {
+          continue;
+        }
+
+        map_ptr<cap_slot_t> src_slot = make_map_ptr(&cap_space->slots[i]);
+        // Bypass the magazine and the deferred slots, which may hold slots above target.
+        map_ptr<cap_slot_t> dst_slot = take_free_slot(task);
+        if (dst_slot == nullptr) [[unlikely]] {
+          break;
+        }
+
+        dst_slot->cap = src_slot->cap;
+        dst_slot->replace(src_slot);
+        replace_cow_memory(task, src_slot, dst_slot);
+
+        remap[count].old_desc = get_cap_slot_index(src_slot);
+        remap[count].new_desc = get_cap_slot_index(dst_slot);
+        ++count;
+
+        // Lock-free readers may still hold the old slot. It is dropped from the deferred list if its cap space is released.
+        defer_free_slots(task, src_slot);
+      }
+
+      preempt_point();
+    }
+  }
+
+  while (task->cap_count.num_cap_space > 1) {
+    uintptr_t            space_index = task->cap_count.num_cap_space - 1;
+    map_ptr<cap_space_t> cap_space   = get_cap_space_at(task, space_index);
+    assert(cap_space != nullptr);
+
+    size_t level;
+    walk_cap_space(task, space_index, level);
+
+    size_t num = level == MEGA_PAGE_TABLE_LEVEL ? CAP_SPACES_PER_MEGA_PAGE : 1;
+    cap_space  = cap_space - (num - 1);
+
+    bool empty = true;
+    for (size_t i = 0; i < num && empty; ++i) {
+      empty = is_empty_cap_space(cap_space + i);
+    }
+
+    if (!empty) {
+      break;
+    }
+
+    unmap_cap_spaces(task, cap_space, num);
+  }
+
+  rebuild_free_slots(task, std::numeric_limits<uintptr_t>::max());
+
+  return true;
+}
+
+bool release_cap_space(map_ptr<cap_space_t> cap_space, bool mega) {
+  assert(cap_space != nullptr);
+
+  map_ptr<task_t> task = cap_space->meta_info.task;
+  if (task == nullptr || cap_space->meta_info.retire_epoch != 0) {
+    return true;
+  }
+
+  std::lock_guard lock(task->lock);
+
+  size_t num = mega ? CAP_SPACES_PER_MEGA_PAGE : 1;
+
+  if (cap_space->meta_info.space_index == 0) [[unlikely]] {
+    logd(tag, "Failed to release cap_space. The first cap space cannot be released.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  if (task->cap_layout == cap_layout_t::dense && cap_space->meta_info.space_index + num != task->cap_count.num_cap_space) [[unlikely]] {
+    logd(tag, "Failed to release cap_space. Only the last cap space can be released in the dense layout.");
+    errno = SYS_E_ILL_STATE;
+    return false;
+  }
+
+  reclaim_deferred_slots(task);
+
+  for (size_t i = 0; i < num; ++i) {
+    if (!is_empty_cap_space(cap_space + i)) [[unlikely]] {
+      logd(tag, "Failed to release cap_space. The cap space is not empty.");
+      errno = SYS_E_CAP_STATE;
+      return false;
+    }
+  }
+
+  unmap_cap_spaces(task, cap_space, num);
+  rebuild_free_slots(task, std::numeric_limits<uintptr_t>::max());
+
+  return true;
+}
+
 map_ptr<cap_slot_t> transfer_cap(map_ptr<task_t> dst_task, map_ptr<cap_slot_t> src_slot) {
   assert(dst_task != nullptr);
   assert(src_slot != nullptr);
@@ -310,7 +871,7 @@ map_ptr<cap_slot_t> transfer_cap(map_ptr<task_t> dst_task, map_ptr<cap_slot_t> s
   }
 
   dst_slot->replace(src_slot);
-  push_free_slots(src_task, src_slot);
+  defer_free_slots(src_task, src_slot);
 
   return dst_slot;
 }
@@ -341,6 +902,9 @@ map_ptr<cap_slot_t> delegate_cap(map_ptr<task_t> task, map_ptr<cap_slot_t> src_s
     return 0_map;
   }
 
+  // A delegated memory cap is no longer the caller's to spend on copies.
+  replace_cow_memory(src_task, src_slot, 0_map);
+
   src_slot->cap = make_zombie_cap();
   src_slot->insert_after(dst_slot);
 
@@ -371,8 +935,29 @@ map_ptr<cap_slot_t> copy_cap(map_ptr<cap_slot_t> src_slot) {
       break;
     case CAP_PAGE_TABLE:
       break;
-    case CAP_VIRT_PAGE:
+    case CAP_VIRT_PAGE: {
+      // A copy is derived from the source. It refers to the same page, is mapped on its own and is revoked with the source.
+      // Mapping a shared page keeps its contents, so a page whose contents are not yet in use by any cap is zeroed here instead.
+      auto& src_cap = src_slot->cap.virt_page;
+      if (!src_cap.device && !src_cap.zeroed && !src_cap.mapped && !src_cap.derived && !src_slot->has_children()) {
+        zero_memory(phys_ptr<void>::from(src_cap.phys_addr).as_map().get(), get_page_size(src_cap.level));
+        src_cap.zeroed = 1;
+      }
+
+      capability_t cap           = src_slot->cap;
+      cap.virt_page.mapped       = false;
+      cap.virt_page.zeroed       = 0;
+      cap.virt_page.derived      = 1;
+      cap.virt_page.index        = 0;
+      cap.virt_page.address      = 0_virt;
+      cap.virt_page.parent_table = 0_map;
+
+      dst_slot = insert_cap(src_task, cap);
+      if (dst_slot != nullptr) {
+        src_slot->insert_child(dst_slot);
+      }
       break;
+    }
     case CAP_CAP_SPACE:
       break;
     case CAP_ID:
@@ -396,7 +981,7 @@ bool revoke_cap(map_ptr<cap_slot_t> slot) {
   assert(slot != nullptr);
 
   cap_type_t type = get_cap_type(slot->cap);
-  if (type != CAP_MEM && type != CAP_ZOMBIE) [[unlikely]] {
+  if (type != CAP_MEM && type != CAP_VIRT_PAGE && type != CAP_ZOMBIE) [[unlikely]] {
     errno = SYS_E_CAP_TYPE;
     return false;
   }
@@ -410,15 +995,12 @@ bool revoke_cap(map_ptr<cap_slot_t> slot) {
   }
 
   if (type == CAP_MEM) {
-    map_ptr<cap_slot_t> cap_slot = slot;
-    while (!cap_slot->is_tail()) {
-      cap_slot = cap_slot->next;
-    }
-    while (cap_slot != slot) {
-      map_ptr<cap_slot_t> prev_slot = cap_slot->prev;
-      destroy_cap_slot(cap_slot);
-      cap_slot = prev_slot;
-    }
+    [[maybe_unused]] bool completed = revoke_descendants(slot, std::numeric_limits<size_t>::max());
+    assert(completed);
+    slot->cap.memory.revoking = 0;
+  } else if (type == CAP_VIRT_PAGE) {
+    [[maybe_unused]] bool completed = revoke_descendants(slot, std::numeric_limits<size_t>::max());
+    assert(completed);
   } else {
     assert(type == CAP_ZOMBIE);
 
@@ -432,10 +1014,10 @@ bool revoke_cap(map_ptr<cap_slot_t> slot) {
     while (cap_slot != slot) {
       map_ptr<cap_slot_t> prev_slot = cap_slot->prev;
 
-      cap_slot->erase_this();
-      push_free_slots(cap_slot->get_cap_space()->meta_info.task, cap_slot);
+      defer_free_slots(cap_slot->get_cap_space()->meta_info.task, cap_slot);
 
       cap_slot = prev_slot;
+      preempt_point();
     }
 
     slot->cap = cap;
@@ -444,6 +1026,29 @@ bool revoke_cap(map_ptr<cap_slot_t> slot) {
   return true;
 }
 
+bool revoke_cap_partially(map_ptr<cap_slot_t> slot, size_t max_count, bool& completed) {
+  assert(slot != nullptr);
+
+  cap_type_t type = get_cap_type(slot->cap);
+  if (type != CAP_MEM) {
+    completed = true;
+    return revoke_cap(slot);
+  }
+
+  map_ptr<task_t>& task = slot->get_cap_space()->meta_info.task;
+
+  std::lock_guard lock(task->lock);
+
+  if (task->state == task_state_t::unused) [[unlikely]] {
+    panic("Unexpected task state.");
+  }
+
+  completed                 = revoke_descendants(slot, max_count);
+  slot->cap.memory.revoking = !completed;
+
+  return true;
+}
+
 bool destroy_cap(map_ptr<cap_slot_t> slot) {
   assert(slot != nullptr);
 
@@ -453,7 +1058,7 @@ bool destroy_cap(map_ptr<cap_slot_t> slot) {
     return false;
   }
 
-  if (type == CAP_MEM || type == CAP_ZOMBIE) {
+  if (type == CAP_MEM || type == CAP_VIRT_PAGE || type == CAP_ZOMBIE) {
     if (!revoke_cap(slot)) [[unlikely]] {
       return false;
     }
@@ -461,15 +1066,14 @@ bool destroy_cap(map_ptr<cap_slot_t> slot) {
 
   if ((slot->prev == nullptr || !is_same_object(slot->prev, slot)) && (slot->next == nullptr || !is_same_object(slot->next, slot))) {
     destroy_object(slot);
-    push_free_slots(slot->get_cap_space()->meta_info.task, slot);
+    defer_free_slots(slot->get_cap_space()->meta_info.task, slot);
   } else if (slot->prev != nullptr && get_cap_type(slot->prev->cap) == CAP_ZOMBIE) {
     assert(is_same_object(slot->prev, slot));
     if (!revoke_cap(slot->prev)) [[unlikely]] {
       return false;
     }
   } else {
-    slot->erase_this();
-    push_free_slots(slot->get_cap_space()->meta_info.task, slot);
+    defer_free_slots(slot->get_cap_space()->meta_info.task, slot);
   }
 
   return true;
@@ -512,7 +1116,8 @@ bool is_same_cap(map_ptr<cap_slot_t> lhs, map_ptr<cap_slot_t> rhs) {
 map_ptr<cap_slot_t> lookup_cap(map_ptr<task_t> task, uintptr_t cap_desc) {
   assert(task != nullptr);
 
-  std::lock_guard lock(task->lock);
+  // This is a lock-free reader. Freed slots are only recycled after a grace period (see defer_free_slots), so the returned slot stays valid until the
+  // next quiescent state, but its cap may be concurrently replaced by a null cap.
 
   if (task->state == task_state_t::unused || task->state == task_state_t::killed) [[unlikely]] {
     logd(tag, "Failed to lookup cap. The task is not running.");
@@ -520,32 +1125,46 @@ map_ptr<cap_slot_t> lookup_cap(map_ptr<task_t> task, uintptr_t cap_desc) {
     return 0_map;
   }
 
-  uintptr_t capacity = task->cap_count.num_cap_space * std::size(static_cast<cap_space_t*>(nullptr)->slots);
-  if (cap_desc >= capacity) [[unlikely]] {
-    logd(tag, "Failed to lookup cap. cap_desc is out of range.");
-    errno = SYS_E_ILL_ARGS;
-    return 0_map;
-  }
+  size_t space_index;
+  size_t slot_index;
 
-  size_t space_index = cap_desc / std::size(static_cast<cap_space_t*>(nullptr)->slots);
-  size_t slot_index  = cap_desc % std::size(static_cast<cap_space_t*>(nullptr)->slots);
+  if (task->cap_layout == cap_layout_t::sparse) {
+    // Unpopulated ranges are rejected by the page walk below.
+    if ((cap_desc >> CAP_DESC_RADIX_BITS) != task->cap_guard) [[unlikely]] {
+      logd(tag, "Failed to lookup cap. The guard of cap_desc does not match.");
+      errno = SYS_E_ILL_ARGS;
+      return 0_map;
+    }
 
-  virt_ptr<void> va = make_virt_ptr(CONFIG_CAPABILITY_SPACE_BASE + PAGE_SIZE * space_index);
+    space_index = (cap_desc >> CAP_DESC_SLOT_BITS) & ((1ULL << CAP_DESC_SPACE_BITS) - 1);
+    slot_index  = cap_desc & ((1ULL << CAP_DESC_SLOT_BITS) - 1);
 
-  map_ptr<page_table_t> page_table = task->root_page_table;
-  map_ptr<pte_t>        pte        = 0_map;
-  for (ssize_t level = MAX_PAGE_TABLE_LEVEL; level >= static_cast<ssize_t>(KILO_PAGE_TABLE_LEVEL); --level) {
-    pte = page_table->walk(va, level);
-    if (pte->is_disabled()) [[unlikely]] {
-      logd(tag, "Failed to lookup cap. The page is not mapped.");
-      errno = SYS_E_ILL_STATE;
+    if (slot_index >= NUM_SLOTS_PER_CAP_SPACE) [[unlikely]] {
+      logd(tag, "Failed to lookup cap. cap_desc is out of range.");
+      errno = SYS_E_ILL_ARGS;
       return 0_map;
     }
-    page_table = pte->get_next_page().as<page_table_t>();
+  } else {
+    uintptr_t capacity = task->cap_count.num_cap_space * NUM_SLOTS_PER_CAP_SPACE;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (cap_desc >= capacity) [[unlikely]] {
+      logd(tag, "Failed to lookup cap. cap_desc is out of range.");
+      errno = SYS_E_ILL_ARGS;
+      return 0_map;
+    }
+
+    space_index = cap_desc / NUM_SLOTS_PER_CAP_SPACE;
+    slot_index  = cap_desc % NUM_SLOTS_PER_CAP_SPACE;
+  }
+
+  map_ptr<cap_space_t> cap_space = get_cap_space_at(task, space_index);
+  if (cap_space == nullptr) [[unlikely]] {
+    logd(tag, "Failed to lookup cap. The page is not mapped.");
+    errno = SYS_E_ILL_STATE;
+    return 0_map;
   }
 
-  map_ptr<cap_space_t> cap_space = page_table.as<cap_space_t>();
-  if (get_cap_type(cap_space->slots[slot_index].cap) == CAP_NULL) [[unlikely]] {
+  if (slot_index >= cap_space->meta_info.watermark || get_cap_type(cap_space->slots[slot_index].cap) == CAP_NULL) [[unlikely]] {
     errno = SYS_S_OK;
     return 0_map;
   }
@@ -561,5 +1180,10 @@ size_t get_cap_slot_index(map_ptr<cap_slot_t> cap_slot) {
   size_t space_index = cap_space->meta_info.space_index;
   size_t slot_index  = cap_slot.get() - cap_space->slots;
 
-  return std::size(static_cast<cap_space_t*>(nullptr)->slots) * space_index + slot_index;
+  map_ptr<task_t>& task = cap_space->meta_info.task;
+  if (task->cap_layout == cap_layout_t::sparse) {
+    return (task->cap_guard << CAP_DESC_RADIX_BITS) | (space_index << CAP_DESC_SLOT_BITS) | slot_index;
+  }
+
+  return NUM_SLOTS_PER_CAP_SPACE * space_index + slot_index;
 }
@@ -170,7 +170,7 @@ bool ipc_receive(bool blocking, map_ptr<endpoint_t> endpoint, virt_ptr<message_t
         std::lock_guard caller_lock(caller->lock);
         assert(caller->state == task_state_t::waiting);
         assert(caller->ipc_state == ipc_state_t::calling);
-        assert(caller->event_type == event_type_t::send);
+        assert(caller->event_type == event_type_t::send || caller->event_type == event_type_t::fault);
         assert(caller->prev_waiting_task == nullptr);
         assert(caller->next_waiting_task == nullptr);
         assert(caller->callee_task == cur_task);
@@ -197,6 +197,11 @@ bool ipc_receive(bool blocking, map_ptr<endpoint_t> endpoint, virt_ptr<message_t
 
         assert(sender->callee_task == nullptr);
 
+        // A fault message is delivered before the faulter is dequeued, so a bad receive buffer leaves it waiting for another receiver.
+        if (sender->event_type == event_type_t::fault && !ipc_transfer_fault_msg(cur_task, sender)) [[unlikely]] {
+          return false;
+        }
+
         remove_waiting_queue(endpoint->sender_queue, sender);
 
         if (sender->event_type == event_type_t::send) {
@@ -218,6 +223,9 @@ bool ipc_receive(bool blocking, map_ptr<endpoint_t> endpoint, virt_ptr<message_t
           }
         } else if (sender->event_type == event_type_t::kill) {
           ipc_transfer_kill_msg(cur_task, sender);
+        } else if (sender->event_type == event_type_t::fault) {
+          sender->callee_task   = cur_task;
+          cur_task->caller_task = sender;
         }
       }
 
@@ -267,6 +275,24 @@ bool ipc_reply(map_ptr<endpoint_t> endpoint, virt_ptr<message_t> msg) {
   assert(caller->callee_task == cur_task);
   assert(caller->state == task_state_t::waiting);
   assert(caller->ipc_state == ipc_state_t::calling);
+
+  // A faulting task takes no reply message. It retries the faulting instruction once resumed.
+  if (caller->event_type == event_type_t::fault) {
+    std::lock_guard caller_lock(caller->lock);
+
+    caller->state         = task_state_t::ready;
+    caller->ipc_state     = ipc_state_t::none;
+    caller->event_type    = event_type_t::none;
+    caller->ipc_msg_state = ipc_msg_state_t::empty;
+    caller->callee_task   = 0_map;
+    caller->endpoint      = 0_map;
+    cur_task->caller_task = 0_map;
+
+    push_ready_queue(caller);
+
+    return true;
+  }
+
   assert(caller->event_type == event_type_t::send);
   assert(caller->ipc_msg_state == ipc_msg_state_t::long_size);
   assert(caller->endpoint == endpoint);
@@ -419,6 +445,65 @@ void ipc_send_kill_notify(map_ptr<endpoint_t> endpoint, map_ptr<task_t> task) {
   resched();
 }
 
+bool ipc_send_fault(map_ptr<endpoint_t> endpoint, uintptr_t addr, fault_access_t access, uintptr_t pc) {
+  assert(endpoint != nullptr);
+
+  map_ptr<task_t> cur_task = get_cls()->current_task;
+
+  cur_task->ipc_short_msg[0] = addr;
+  cur_task->ipc_short_msg[1] = static_cast<uintptr_t>(access);
+  cur_task->ipc_short_msg[2] = pc;
+  cur_task->ipc_msg_state    = ipc_msg_state_t::short_size;
+  cur_task->state            = task_state_t::waiting;
+  cur_task->ipc_state        = ipc_state_t::calling;
+  cur_task->event_type       = event_type_t::fault;
+  cur_task->endpoint         = endpoint;
+
+  {
+    std::unique_lock ep_lock(endpoint->lock);
+
+    if (endpoint->receiver_queue.head != nullptr) {
+      assert(endpoint->sender_queue.head == nullptr);
+
+      map_ptr<task_t> receiver = endpoint->receiver_queue.head;
+
+      std::lock_guard recv_lock(receiver->lock);
+
+      if (!ipc_transfer_fault_msg(receiver, cur_task)) [[unlikely]] {
+        cur_task->state         = task_state_t::running;
+        cur_task->ipc_state     = ipc_state_t::none;
+        cur_task->event_type    = event_type_t::none;
+        cur_task->ipc_msg_state = ipc_msg_state_t::empty;
+        cur_task->endpoint      = 0_map;
+        return false;
+      }
+
+      remove_waiting_queue(endpoint->receiver_queue, receiver);
+
+      receiver->state         = task_state_t::ready;
+      receiver->ipc_state     = ipc_state_t::none;
+      receiver->caller_task   = cur_task;
+      receiver->endpoint      = 0_map;
+      cur_task->callee_task   = receiver;
+
+      push_ready_queue(receiver);
+    } else {
+      push_waiting_queue(endpoint->sender_queue, cur_task);
+    }
+  }
+
+  resched();
+
+  assert(cur_task->ipc_state == ipc_state_t::none || cur_task->ipc_state == ipc_state_t::canceled);
+  assert(cur_task->event_type == event_type_t::none);
+
+  if (cur_task->ipc_state == ipc_state_t::canceled) {
+    errno = SYS_E_CANCELED;
+  }
+
+  return cur_task->ipc_state == ipc_state_t::none;
+}
+
 bool ipc_transfer_ipc_msg(map_ptr<task_t> dst, map_ptr<task_t> src) {
   assert(dst != nullptr);
   assert(src != nullptr);
@@ -569,6 +654,50 @@ bool ipc_transfer_kill_msg(map_ptr<task_t> dst, map_ptr<task_t> src) {
   return true;
 }
 
+bool ipc_transfer_fault_msg(map_ptr<task_t> dst, map_ptr<task_t> src) {
+  assert(dst != nullptr);
+  assert(src != nullptr);
+  assert(src->event_type == event_type_t::fault);
+
+  if (dst->ipc_msg_state != ipc_msg_state_t::long_size) [[unlikely]] {
+    panic("Unexpected ipc msg state: %d", dst->ipc_msg_state);
+  }
+
+  message_header header;
+  if (!read_user_memory(dst, dst->ipc_long_msg.raw(), make_map_ptr(&header), sizeof(message_header))) [[unlikely]] {
+    loge(tag, "Failed to read user memory: tid=%d, addr=%p", dst->tid, dst->ipc_long_msg);
+    return false;
+  }
+
+  constexpr size_t payload_length = sizeof(uintptr_t) * 3;
+
+  if (header.payload_capacity < payload_length) [[unlikely]] {
+    loge(tag, "Payload capacity is too small: dst-tid=%d, src-tid=%d, dst-capacity=%d, src-length=%d", dst->tid, src->tid, header.payload_capacity, payload_length);
+    return false;
+  }
+
+  header.msg_type         = MSG_TYPE_FAULT;
+  header.sender_id        = std::bit_cast<uint32_t>(src->tid);
+  header.receiver_id      = std::bit_cast<uint32_t>(dst->tid);
+  header.payload_length   = payload_length;
+  header.data_type_map[0] = 0;
+  header.data_type_map[1] = 0;
+
+  if (!write_user_memory(dst, make_map_ptr(&header), dst->ipc_long_msg.raw(), sizeof(message_header))) [[unlikely]] {
+    loge(tag, "Failed to write user memory: tid=%d, addr=%p", dst->tid, dst->ipc_long_msg);
+    return false;
+  }
+
+  if (!write_user_memory(dst, make_map_ptr(src->ipc_short_msg), dst->ipc_long_msg.raw() + sizeof(message_header), payload_length)) [[unlikely]] {
+    loge(tag, "Failed to write user memory: tid=%d, addr=%p", dst->tid, dst->ipc_long_msg);
+    return false;
+  }
+
+  dst->ipc_msg_state = ipc_msg_state_t::empty;
+
+  return true;
+}
+
 void push_waiting_queue(task_queue_t& queue, map_ptr<task_t> task) {
   assert(task != nullptr);
   assert(task->state == task_state_t::waiting);
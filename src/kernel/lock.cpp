@@ -1,13 +1,36 @@
 #include <bit>
 
 #include <kernel/cls.h>
+#include <kernel/cpu.h>
 #include <kernel/lock.h>
 #include <kernel/log.h>
 #include <kernel/task.h>
+#include <kernel/trap.h>
+
+namespace {
+  constexpr uint32_t max_backoff = 1 << 8;
+
+  static_assert(sizeof(std::atomic_flag) == sizeof(uint8_t));
+
+  // Test-and-test-and-set with bounded exponential backoff. Once the backoff saturates, wait for the lock word to change instead of polling it.
+  void spin_wait(std::atomic_flag& state) {
+    uint32_t backoff = 1;
+    while (state.test(std::memory_order_relaxed)) {
+      if (backoff < max_backoff) {
+        for (uint32_t i = 0; i < backoff; ++i) {
+          cpu_relax();
+        }
+        backoff <<= 1;
+      } else {
+        cpu_wait_while_set(reinterpret_cast<const volatile uint8_t*>(&state));
+      }
+    }
+  }
+} // namespace
 
 void spinlock_t::lock() {
   while (state.test_and_set(std::memory_order_acquire)) {
-    // busy waiting
+    spin_wait(state);
   }
 }
 
@@ -19,6 +42,17 @@ bool spinlock_t::try_lock() {
   return !state.test_and_set(std::memory_order_acquire);
 }
 
+uintptr_t spinlock_t::lock_irqsave() {
+  uintptr_t flags = irq_save();
+  lock();
+  return flags;
+}
+
+void spinlock_t::unlock_irqrestore(uintptr_t flags) {
+  unlock();
+  irq_restore(flags);
+}
+
 void recursive_spinlock_t::lock() {
   uint32_t current_tid = std::bit_cast<uint32_t>(get_cls()->current_task->tid);
 
@@ -29,7 +63,7 @@ void recursive_spinlock_t::lock() {
 
   while (true) {
     while (state.test_and_set(std::memory_order_acquire)) {
-      // busy waiting
+      spin_wait(state);
     }
 
     if (owner == 0) {
@@ -73,3 +107,14 @@ bool recursive_spinlock_t::try_lock() {
 
   return true;
 }
+
+uintptr_t recursive_spinlock_t::lock_irqsave() {
+  uintptr_t flags = irq_save();
+  lock();
+  return flags;
+}
+
+void recursive_spinlock_t::unlock_irqrestore(uintptr_t flags) {
+  unlock();
+  irq_restore(flags);
+}
@@ -0,0 +1,37 @@
+#include <atomic>
+
+#include <kernel/core_id.h>
+#include <kernel/rcu.h>
+
+namespace {
+  struct alignas(64) rcu_core_state_t {
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool>     online;
+  };
+
+  std::atomic<uint64_t> global_epoch = 1;
+  rcu_core_state_t      core_states[CONFIG_MAX_CORES];
+} // namespace
+
+void rcu_online() {
+  rcu_core_state_t& state = core_states[get_core_id()];
+  state.epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_release);
+  state.online.store(true, std::memory_order_release);
+}
+
+void rcu_quiescent_state() {
+  core_states[get_core_id()].epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+uint64_t rcu_retire_epoch() {
+  return global_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+bool rcu_is_expired(uint64_t epoch) {
+  for (const auto& state : core_states) {
+    if (state.online.load(std::memory_order_acquire) && state.epoch.load(std::memory_order_acquire) < epoch) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -11,6 +11,7 @@
 #include <kernel/core_id.h>
 #include <kernel/log.h>
 #include <kernel/page.h>
+#include <kernel/rcu.h>
 #include <kernel/setup.h>
 #include <kernel/start.h>
 #include <kernel/task.h>
@@ -89,7 +90,7 @@ __init_code void setup_root_task() {
   boot_info->root_boot_info->root_task_cap = get_cap_slot_index(root_task_cap_slot);
 
   std::for_each(std::begin(boot_info->cap_spaces), std::end(boot_info->cap_spaces), [&boot_info](auto&& cap_space) {
-    map_ptr<cap_slot_t> slot = insert_cap(boot_info->root_task, make_cap_space_cap(cap_space, true));
+    map_ptr<cap_slot_t> slot = insert_cap(boot_info->root_task, make_cap_space_cap(cap_space, true, false));
     if (slot == nullptr) [[unlikely]] {
       panic("Failed to insert the cap space capability.");
     }
@@ -138,15 +139,22 @@ __init_code void setup_cap_space() {
 }
 
 template<size_t N, size_t M>
-__init_code void map_root_task(virt_ptr<void> va_base, const char* begin, const char* end, map_ptr<page_table_t> (&page_tables)[N], page_table_cap_t (&dst)[M], pte_flags_t flags) {
+__init_code void map_root_task(virt_ptr<void>        va_base,
+                               const char*           begin,
+                               const char*           end,
+                               map_ptr<page_table_t> (&page_tables)[N],
+                               map_ptr<page_table_t> tail_page_table,
+                               page_table_cap_t (&dst)[M],
+                               pte_flags_t flags) {
   map_ptr<boot_info_t> boot_info = get_boot_info();
 
   std::for_each(std::begin(page_tables), std::end(page_tables), [](auto&& page_table) { memset(page_table.get(), 0, sizeof(page_table_t)); });
+  memset(tail_page_table.get(), 0, sizeof(page_table_t));
 
   map_ptr<page_table_t> page_table = boot_info->root_page_table;
   map_ptr<pte_t>        pte        = 0_map;
 
-  for (size_t level = MAX_PAGE_TABLE_LEVEL; level > KILO_PAGE_TABLE_LEVEL; --level) {
+  for (size_t level = MAX_PAGE_TABLE_LEVEL; level > MEGA_PAGE_TABLE_LEVEL; --level) {
     map_ptr<page_table_t> next_page_table = page_tables[level - 1];
 
     pte = page_table->walk(va_base, level);
@@ -163,11 +171,53 @@ __init_code void map_root_task(virt_ptr<void> va_base, const char* begin, const
     page_table     = next_page_table;
   }
 
+  // Kilo page tables are hooked lazily: the first one covers the unaligned head (or the whole image), the second one the unaligned tail.
+  map_ptr<page_table_t> kilo_page_tables[]    = { page_tables[KILO_PAGE_TABLE_LEVEL], tail_page_table };
+  size_t                num_kilo_page_tables = 0;
+
+  auto get_kilo_page_table = [&](virt_ptr<void> va) -> map_ptr<page_table_t> {
+    map_ptr<pte_t> mega_pte = page_table->walk(va, MEGA_PAGE_TABLE_LEVEL);
+    if (mega_pte->is_enabled()) {
+      assert(mega_pte->is_table());
+      return mega_pte->get_next_page().as<page_table_t>();
+    }
+
+    if (num_kilo_page_tables == std::size(kilo_page_tables)) [[unlikely]] {
+      panic("The root task does not fit in the boot page tables.");
+    }
+
+    map_ptr<page_table_t> kilo_page_table = kilo_page_tables[num_kilo_page_tables];
+    mega_pte->set_next_page(kilo_page_table.as<void>());
+    mega_pte->enable();
+
+    virt_ptr<void>      virt_addr_base      = make_virt_ptr(round_down(va.raw(), get_page_size(MEGA_PAGE_TABLE_LEVEL)));
+    map_ptr<cap_slot_t> page_table_cap_slot = insert_cap(boot_info->root_task, make_page_table_cap(kilo_page_table, true, KILO_PAGE_TABLE_LEVEL, virt_addr_base, page_table));
+    if (page_table_cap_slot == nullptr) [[unlikely]] {
+      panic("Failed to insert the page table capability.");
+    }
+    if (num_kilo_page_tables++ == 0) {
+      dst[KILO_PAGE_TABLE_LEVEL] = get_cap_slot_index(page_table_cap_slot);
+    }
+
+    return kilo_page_table;
+  };
+
+  constexpr size_t mega_page_size = get_page_size(MEGA_PAGE_TABLE_LEVEL);
+
   size_t size = end - begin;
-  for (uintptr_t va_offset = 0; va_offset < size; va_offset += PAGE_SIZE) {
-    map_ptr<void> page = make_map_ptr(begin + va_offset);
+  for (uintptr_t va_offset = 0; va_offset < size;) {
+    map_ptr<void>  page = make_map_ptr(begin + va_offset);
+    virt_ptr<void> va   = va_base + va_offset;
+
+    // The last part of the image always stays on kilo pages, so that whatever is mapped right after it (e.g. the dtb) finds a kilo page table.
+    size_t level = KILO_PAGE_TABLE_LEVEL;
+    if (va.raw() % mega_page_size == 0 && page.as_phys().raw() % mega_page_size == 0 && size - va_offset > mega_page_size) {
+      level = MEGA_PAGE_TABLE_LEVEL;
+    }
 
-    pte = page_table->walk(va_base + va_offset, KILO_PAGE_TABLE_LEVEL);
+    map_ptr<page_table_t> parent_table = level == MEGA_PAGE_TABLE_LEVEL ? page_table : get_kilo_page_table(va);
+
+    pte = parent_table->walk(va, level);
     assert(pte->is_disabled());
     pte->set_flags(flags);
     pte->set_next_page(page);
@@ -175,13 +225,15 @@ __init_code void map_root_task(virt_ptr<void> va_base, const char* begin, const
 
     map_ptr<cap_slot_t>
         virt_page_cap_slot = insert_cap(boot_info->root_task,
-                                        make_virt_page_cap(false, flags.readable, flags.writable, flags.executable, true, KILO_PAGE_TABLE_LEVEL, page.as_phys(), va_base + va_offset, page_table));
+                                        make_virt_page_cap(false, flags.readable, flags.writable, flags.executable, true, level, page.as_phys(), va, parent_table));
     if (virt_page_cap_slot == nullptr) [[unlikely]] {
       panic("Failed to insert the virtual page capability.");
     }
     boot_info->root_boot_info->caps[boot_info->root_boot_info->virt_page_caps_offset + boot_info->root_boot_info->num_virt_page_caps++] = get_cap_slot_index(virt_page_cap_slot);
 
-    logd(tag, "Mapped page %p -> %p (4k)", va_base + va_offset, page.as_phys());
+    logd(tag, "Mapped page %p -> %p (%s)", va, page.as_phys(), level == MEGA_PAGE_TABLE_LEVEL ? "2m" : "4k");
+
+    va_offset += get_page_size(level);
   }
 }
 
@@ -190,7 +242,7 @@ __init_code void load_root_task_payload() {
   constexpr pte_flags_t    flags   = { .readable = 1, .writable = 1, .executable = 1, .user = 1, .global = 0 };
 
   map_ptr<boot_info_t> boot_info = get_boot_info();
-  map_root_task(va_base, _payload_start, _payload_end, boot_info->payload_page_tables, boot_info->root_boot_info->page_table_caps, flags);
+  map_root_task(va_base, _payload_start, _payload_end, boot_info->payload_page_tables, boot_info->payload_tail_page_table, boot_info->root_boot_info->page_table_caps, flags);
 }
 
 __init_code void setup_root_task_stack() {
@@ -199,7 +251,7 @@ __init_code void setup_root_task_stack() {
   constexpr pte_flags_t flags   = { .readable = 1, .writable = 1, .executable = 0, .user = 1, .global = 0 };
 
   map_ptr<boot_info_t> boot_info = get_boot_info();
-  map_root_task(va_base, _root_task_stack_start, _root_task_stack_end, boot_info->stack_page_tables, boot_info->root_boot_info->stack_page_table_caps, flags);
+  map_root_task(va_base, _root_task_stack_start, _root_task_stack_end, boot_info->stack_page_tables, boot_info->stack_tail_page_table, boot_info->root_boot_info->stack_page_table_caps, flags);
 }
 
 __init_code void setup_root_task_payload() {
@@ -236,7 +288,9 @@ __init_code void setup_idle_task() {
 
 __init_code void setup() {
   set_core_id(get_boot_info()->core_id);
+  rcu_online();
   setup_early_trap();
+  setup_arch(get_boot_info());
   setup_root_task();
   setup_cap_space();
   setup_root_task_payload();
@@ -1,11 +1,115 @@
+#include <algorithm>
+#include <mutex>
+
 #include <kernel/cap_space.h>
 #include <kernel/cls.h>
 #include <kernel/log.h>
 #include <kernel/syscall/ns_cap.h>
 #include <kernel/task.h>
+#include <kernel/user_memory.h>
 
 namespace {
   constexpr const char* tag = "syscall/cap";
+
+  bool validate_batch_entry(map_ptr<task_t> task, const cap_batch_entry_t& entry, map_ptr<cap_slot_t>& cap_slot, map_ptr<task_t>& dst_task) {
+    // lookup_cap reports a null slot with SYS_S_OK, which the caller would read as an entry to issue again.
+    cap_slot = lookup_cap(task, entry.cap);
+    if (cap_slot == nullptr) [[unlikely]] {
+      loge(tag, "Failed to look up cap: %d", entry.cap);
+      if (errno == SYS_S_OK) {
+        errno = SYS_E_CAP_TYPE;
+      }
+      return false;
+    }
+
+    dst_task = 0_map;
+
+    switch (entry.op) {
+      case cap_batch_op_t::copy:
+      case cap_batch_op_t::revoke:
+      case cap_batch_op_t::destroy:
+        return true;
+      case cap_batch_op_t::transfer:
+      case cap_batch_op_t::delegate: {
+        map_ptr<cap_slot_t> task_cap_slot = lookup_cap(task, entry.task_cap);
+        if (task_cap_slot == nullptr) [[unlikely]] {
+          loge(tag, "Failed to look up cap: %d", entry.task_cap);
+          if (errno == SYS_S_OK) {
+            errno = SYS_E_CAP_TYPE;
+          }
+          return false;
+        }
+
+        if (get_cap_type(task_cap_slot->cap) != CAP_TASK) [[unlikely]] {
+          loge(tag, "Cap is not a task cap: %d", entry.task_cap);
+          errno = SYS_E_CAP_TYPE;
+          return false;
+        }
+
+        dst_task = task_cap_slot->cap.task.task;
+        if (dst_task->state != task_state_t::suspended) [[unlikely]] {
+          loge(tag, "This task is not suspended: %d", entry.task_cap);
+          errno = SYS_E_ILL_STATE;
+          return false;
+        }
+
+        return true;
+      }
+      default:
+        loge(tag, "Unknown batch operation: %u", static_cast<uint32_t>(entry.op));
+        errno = SYS_E_ILL_ARGS;
+        return false;
+    }
+  }
+
+  // Returns false with errno set if the entry failed, and sets completed to false if it has to be issued again.
+  bool execute_batch_entry(cap_batch_entry_t& entry, map_ptr<cap_slot_t> cap_slot, map_ptr<task_t> dst_task, bool& completed) {
+    completed    = true;
+    entry.result = 0;
+
+    switch (entry.op) {
+      case cap_batch_op_t::copy: {
+        map_ptr<cap_slot_t> result = copy_cap(cap_slot);
+        if (result == nullptr) [[unlikely]] {
+          return false;
+        }
+        entry.result = get_cap_slot_index(result);
+        return true;
+      }
+      case cap_batch_op_t::revoke:
+        return revoke_cap_partially(cap_slot, REVOKE_BATCH_SIZE, completed);
+      case cap_batch_op_t::destroy:
+        if (get_cap_type(cap_slot->cap) == CAP_MEM) {
+          if (!revoke_cap_partially(cap_slot, REVOKE_BATCH_SIZE, completed)) [[unlikely]] {
+            return false;
+          }
+
+          if (!completed) {
+            return true;
+          }
+        }
+        return destroy_cap(cap_slot);
+      case cap_batch_op_t::transfer: {
+        map_ptr<cap_slot_t> result = transfer_cap(dst_task, cap_slot);
+        if (result == nullptr) [[unlikely]] {
+          return false;
+        }
+        entry.result = get_cap_slot_index(result);
+        return true;
+      }
+      case cap_batch_op_t::delegate: {
+        map_ptr<cap_slot_t> result = delegate_cap(dst_task, cap_slot);
+        if (result == nullptr) [[unlikely]] {
+          return false;
+        }
+        entry.result = get_cap_slot_index(result);
+        return true;
+      }
+      default:
+        errno = SYS_E_ILL_ARGS;
+        return false;
+    }
+  }
 } // namespace
 
 sysret_t invoke_sys_cap_type(map_ptr<syscall_args_t> args) {
@@ -52,11 +156,16 @@ sysret_t invoke_sys_cap_revoke(map_ptr<syscall_args_t> args) {
     return errno_to_sysret();
   }
 
-  if (!revoke_cap(cap_slot)) [[unlikely]] {
+  bool completed;
+  if (!revoke_cap_partially(cap_slot, REVOKE_BATCH_SIZE, completed)) [[unlikely]] {
     loge(tag, "Failed to revoke cap: %d", args->args[0]);
     return errno_to_sysret();
   }
 
+  if (!completed) {
+    return restart_syscall();
+  }
+
   return sysret_s_ok(0);
 }
 
@@ -69,6 +178,18 @@ sysret_t invoke_sys_cap_destroy(map_ptr<syscall_args_t> args) {
     return errno_to_sysret();
   }
 
+  if (get_cap_type(cap_slot->cap) == CAP_MEM) {
+    bool completed;
+    if (!revoke_cap_partially(cap_slot, REVOKE_BATCH_SIZE, completed)) [[unlikely]] {
+      loge(tag, "Failed to revoke cap: %d", args->args[0]);
+      return errno_to_sysret();
+    }
+
+    if (!completed) {
+      return restart_syscall();
+    }
+  }
+
   if (!destroy_cap(cap_slot)) [[unlikely]] {
     loge(tag, "Failed to destroy cap: %d", args->args[0]);
     return errno_to_sysret();
@@ -94,3 +215,77 @@ sysret_t invoke_sys_cap_same(map_ptr<syscall_args_t> args) {
 
   return sysret_s_ok(is_same_cap(lhs_cap_slot, rhs_cap_slot));
 }
+
+sysret_t invoke_sys_cap_batch(map_ptr<syscall_args_t> args) {
+  map_ptr<task_t>& task = get_cls()->current_task;
+
+  uintptr_t buf   = args->args[0];
+  size_t    count = args->args[1];
+
+  if (count == 0 || count > CAP_BATCH_MAX_ENTRIES) [[unlikely]] {
+    loge(tag, "Invalid number of batch entries: %d", count);
+    return sysret_e_ill_args();
+  }
+
+  cap_batch_entry_t entries[CAP_BATCH_MAX_ENTRIES];
+  if (!read_user_memory(task, buf, make_map_ptr(entries), sizeof(cap_batch_entry_t) * count)) [[unlikely]] {
+    loge(tag, "Failed to read batch entries: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  map_ptr<cap_slot_t> cap_slots[CAP_BATCH_MAX_ENTRIES];
+  map_ptr<task_t>     dst_tasks[CAP_BATCH_MAX_ENTRIES];
+
+  // Nothing is executed unless every entry is valid.
+  for (size_t i = 0; i < count; ++i) {
+    if (!validate_batch_entry(task, entries[i], cap_slots[i], dst_tasks[i])) [[unlikely]] {
+      entries[i].result = 0;
+      entries[i].error  = errno;
+      if (!write_user_memory(task, make_map_ptr(&entries[i]), buf + sizeof(cap_batch_entry_t) * i, sizeof(cap_batch_entry_t))) [[unlikely]] {
+        return sysret_e_ill_args();
+      }
+      return sysret_t { i, entries[i].error };
+    }
+  }
+
+  // The number of finished entries is returned. The caller issues the remaining entries again if it is less than count.
+  size_t         done  = 0;
+  sysret_error_t error = SYS_S_OK;
+  {
+    std::lock_guard lock(task->lock);
+
+    for (; done < count; ++done) {
+      // An earlier entry may have destroyed or moved the caps of this one, so it is checked again right before it runs.
+      if (!validate_batch_entry(task, entries[done], cap_slots[done], dst_tasks[done])) [[unlikely]] {
+        entries[done].result = 0;
+        error                = errno;
+        break;
+      }
+
+      bool completed;
+      if (!execute_batch_entry(entries[done], cap_slots[done], dst_tasks[done], completed)) [[unlikely]] {
+        loge(tag, "Failed to execute batch entry: %d", done);
+        error = errno;
+        break;
+      }
+
+      entries[done].error = SYS_S_OK;
+
+      if (!completed) {
+        break;
+      }
+    }
+  }
+
+  if (error != SYS_S_OK) {
+    entries[done].error = error;
+  }
+
+  size_t written = std::min(done + 1, count);
+  if (!write_user_memory(task, make_map_ptr(entries), buf, sizeof(cap_batch_entry_t) * written)) [[unlikely]] {
+    loge(tag, "Failed to write batch results: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  return sysret_t { done, error };
+}
@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include <kernel/cap.h>
 #include <kernel/cap_space.h>
 #include <kernel/cls.h>
@@ -83,3 +85,64 @@ sysret_t invoke_sys_mem_cap_create_object(map_ptr<syscall_args_t> args) {
 
   return sysret_s_ok(get_cap_slot_index(result));
 }
+
+sysret_t invoke_sys_mem_cap_set_allocator(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_mem_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  std::lock_guard lock(get_cls()->current_task->lock);
+
+  if (!set_memory_allocator(cap_slot, static_cast<mem_allocator_t>(args->args[1]))) [[unlikely]] {
+    loge(tag, "Failed to set memory allocator: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_mem_cap_create_objects(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_mem_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> result = create_objects(get_cls()->current_task, cap_slot, static_cast<cap_type_t>(args->args[1]), args->args[2], args->args[3], args->args[4], args->args[5], args->args[6]);
+
+  if (result == nullptr) [[unlikely]] {
+    loge(tag, "Failed to create objects: type=%d, count=%d", args->args[1], args->args[2]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(get_cap_slot_index(result));
+}
+
+sysret_t invoke_sys_mem_cap_prezero(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_mem_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  std::lock_guard lock(get_cls()->current_task->lock);
+
+  if (!set_memory_prezero(cap_slot)) [[unlikely]] {
+    loge(tag, "Failed to register memory for prezeroing: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_mem_cap_node(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_mem_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(cap_slot->cap.memory.node);
+}
@@ -1,8 +1,11 @@
+#include <algorithm>
+
 #include <kernel/cap_space.h>
 #include <kernel/cls.h>
 #include <kernel/log.h>
 #include <kernel/syscall/ns_page_table_cap.h>
 #include <kernel/task.h>
+#include <kernel/user_memory.h>
 
 namespace {
   constexpr const char* tag = "syscall/page_table_cap";
@@ -94,7 +97,10 @@ sysret_t invoke_sys_page_table_cap_map_page(map_ptr<syscall_args_t> args) {
 
   map_ptr<cap_slot_t> virt_page_slot = lookup_cap(get_cls()->current_task, args->args[5]);
 
-  if (!map_virt_page_cap(cap_slot, args->args[1], virt_page_slot, args->args[2], args->args[3], args->args[4])) [[unlikely]] {
+  mem_type_t mem_type = static_cast<mem_type_t>(args->args[6] & VIRT_PAGE_MAP_MEM_TYPE_MASK);
+  bool       tracked  = args->args[6] & VIRT_PAGE_MAP_TRACKED;
+
+  if (!map_virt_page_cap(cap_slot, args->args[1], virt_page_slot, args->args[2], args->args[3], args->args[4], mem_type, tracked)) [[unlikely]] {
     loge(tag, "Failed to map virt page cap: %d", args->args[0]);
     return errno_to_sysret();
   }
@@ -151,3 +157,116 @@ sysret_t invoke_sys_page_table_cap_virt_addr_base(map_ptr<syscall_args_t> args)
 
   return sysret_s_ok(cap_slot->cap.page_table.virt_addr_base);
 }
+
+sysret_t invoke_sys_page_table_cap_map_pages(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_page_table_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<task_t>&      task  = get_cls()->current_task;
+  uintptr_t             buf   = args->args[2];
+  size_t                count = std::min<size_t>(args->args[3], VIRT_PAGE_RANGE_MAX_ENTRIES);
+  virt_page_map_entry_t entries[VIRT_PAGE_RANGE_MAX_ENTRIES];
+
+  if (!read_user_memory(task, buf, make_map_ptr(entries), sizeof(virt_page_map_entry_t) * count)) [[unlikely]] {
+    loge(tag, "Failed to read virt page map entries: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  if (!map_virt_page_caps(task, cap_slot, args->args[1], entries, count)) [[unlikely]] {
+    loge(tag, "Failed to map virt page caps: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(count);
+}
+
+sysret_t invoke_sys_page_table_cap_unmap_pages(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_page_table_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<task_t>& task  = get_cls()->current_task;
+  uintptr_t        buf   = args->args[2];
+  size_t           count = std::min<size_t>(args->args[3], VIRT_PAGE_RANGE_MAX_ENTRIES);
+  uintptr_t        virt_pages[VIRT_PAGE_RANGE_MAX_ENTRIES];
+
+  if (!read_user_memory(task, buf, make_map_ptr(virt_pages), sizeof(uintptr_t) * count)) [[unlikely]] {
+    loge(tag, "Failed to read virt page caps: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  if (!unmap_virt_page_caps(task, cap_slot, args->args[1], virt_pages, count)) [[unlikely]] {
+    loge(tag, "Failed to unmap virt page caps: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(count);
+}
+
+sysret_t invoke_sys_page_table_cap_scan_accessed_dirty(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_page_table_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  size_t    count = args->args[2];
+  uintptr_t buf   = args->args[3];
+  uint64_t  bitmaps[ACCESSED_DIRTY_BITMAP_WORDS * 2];
+
+  if (!scan_accessed_dirty(cap_slot, args->args[1], count, bitmaps, bitmaps + ACCESSED_DIRTY_BITMAP_WORDS, args->args[4])) [[unlikely]] {
+    loge(tag, "Failed to scan accessed and dirty bits: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  // The accessed bitmap is followed by the dirty bitmap, each rounded up to whole words.
+  size_t num_words = (count + 63) / 64;
+  if (num_words != 0) {
+    std::copy_n(bitmaps + ACCESSED_DIRTY_BITMAP_WORDS, num_words, bitmaps + num_words);
+    if (!write_user_memory(get_cls()->current_task, make_map_ptr(bitmaps), buf, sizeof(uint64_t) * num_words * 2)) [[unlikely]] {
+      loge(tag, "Failed to write accessed and dirty bitmaps: %p", buf);
+      return sysret_e_ill_args();
+    }
+  }
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_page_table_cap_promote(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_page_table_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> child_page_table_slot = lookup_cap(get_cls()->current_task, args->args[2]);
+
+  if (!promote_virt_pages(get_cls()->current_task, cap_slot, args->args[1], child_page_table_slot)) [[unlikely]] {
+    loge(tag, "Failed to promote virt pages: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_page_table_cap_demote(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_page_table_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> child_page_table_slot = lookup_cap(get_cls()->current_task, args->args[2]);
+
+  if (!demote_virt_page(get_cls()->current_task, cap_slot, args->args[1], child_page_table_slot)) [[unlikely]] {
+    loge(tag, "Failed to demote virt page: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
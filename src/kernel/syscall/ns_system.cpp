@@ -3,6 +3,7 @@
 #include <kernel/cap_space.h>
 #include <kernel/core_id.h>
 #include <kernel/log.h>
+#include <kernel/numa.h>
 #include <kernel/page.h>
 #include <kernel/syscall/ns_system.h>
 #include <kernel/task.h>
@@ -55,3 +56,19 @@ sysret_t invoke_sys_system_cap_align(map_ptr<syscall_args_t> args) {
   }
   return sysret_s_ok(get_cap_align(static_cast<cap_type_t>(args->args[0])));
 }
+
+sysret_t invoke_sys_system_core_node(map_ptr<syscall_args_t> args) {
+  if (args->args[0] >= CONFIG_MAX_CORES) {
+    loge(tag, "Invalid core id: %d", args->args[0]);
+    return sysret_e_ill_args();
+  }
+  return sysret_s_ok(get_core_numa_node(args->args[0]));
+}
+
+sysret_t invoke_sys_system_node_distance(map_ptr<syscall_args_t> args) {
+  if (args->args[0] >= CONFIG_MAX_NUMA_NODES || args->args[1] >= CONFIG_MAX_NUMA_NODES) {
+    loge(tag, "Invalid NUMA node: %d, %d", args->args[0], args->args[1]);
+    return sysret_e_ill_args();
+  }
+  return sysret_s_ok(get_numa_distance(args->args[0], args->args[1]));
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <bit>
 #include <mutex>
 
@@ -6,6 +7,7 @@
 #include <kernel/log.h>
 #include <kernel/syscall/ns_task_cap.h>
 #include <kernel/task.h>
+#include <kernel/user_memory.h>
 
 namespace {
   constexpr const char* tag = "syscall/task_cap";
@@ -289,7 +291,7 @@ sysret_t invoke_sys_task_cap_get_free_slot_count(map_ptr<syscall_args_t> args) {
     return errno_to_sysret();
   }
 
-  return sysret_s_ok(cap_slot->cap.task.task->free_slots_count);
+  return sysret_s_ok(get_free_slot_count(cap_slot->cap.task.task));
 }
 
 sysret_t invoke_sys_task_cap_get_cap_space_count(map_ptr<syscall_args_t> args) {
@@ -331,7 +333,7 @@ sysret_t invoke_sys_task_cap_insert_cap_space(map_ptr<syscall_args_t> args) {
     return sysret_e_cap_type();
   }
 
-  if (!insert_cap_space(cap_slot, cap_space_slot)) [[unlikely]] {
+  if (!insert_cap_space(cap_slot, cap_space_slot, args->args[2])) [[unlikely]] {
     loge(tag, "Failed to insert cap space: %d", args->args[1]);
     return errno_to_sysret();
   }
@@ -339,6 +341,33 @@ sysret_t invoke_sys_task_cap_insert_cap_space(map_ptr<syscall_args_t> args) {
   return sysret_s_ok(0);
 }
 
+sysret_t invoke_sys_task_cap_insert_mega_cap_space(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> mem_slot = lookup_cap(get_cls()->current_task, args->args[1]);
+
+  if (mem_slot == nullptr) [[unlikely]] {
+    loge(tag, "Failed to look up cap: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  if (get_cap_type(mem_slot->cap) != CAP_MEM) [[unlikely]] {
+    loge(tag, "Invalid cap type: %d", get_cap_type(mem_slot->cap));
+    return sysret_e_cap_type();
+  }
+
+  if (!insert_mega_cap_space(cap_slot, mem_slot)) [[unlikely]] {
+    loge(tag, "Failed to insert mega cap space: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
+
 sysret_t invoke_sys_task_cap_extend_cap_space(map_ptr<syscall_args_t> args) {
   map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
 
@@ -358,7 +387,7 @@ sysret_t invoke_sys_task_cap_extend_cap_space(map_ptr<syscall_args_t> args) {
     return sysret_e_cap_type();
   }
 
-  if (!extend_cap_space(cap_slot, page_table_slot)) [[unlikely]] {
+  if (!extend_cap_space(cap_slot, page_table_slot, args->args[2])) [[unlikely]] {
     loge(tag, "Failed to extend cap space: %d", args->args[1]);
     return errno_to_sysret();
   }
@@ -389,3 +418,128 @@ sysret_t invoke_sys_task_cap_set_kill_notify(map_ptr<syscall_args_t> args) {
 
   return sysret_s_ok(0);
 }
+
+sysret_t invoke_sys_task_cap_set_cap_layout(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  auto& task_cap = cap_slot->cap.task;
+
+  if (task_cap.task->state != task_state_t::suspended) [[unlikely]] {
+    loge(tag, "This task is not suspended: %d", args->args[0]);
+    return sysret_e_ill_state();
+  }
+
+  if (!set_cap_layout(task_cap.task, static_cast<cap_layout_t>(args->args[1]), args->args[2])) [[unlikely]] {
+    loge(tag, "Failed to set cap layout: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_task_cap_compact_cap_space(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  auto&            task_cap = cap_slot->cap.task;
+  map_ptr<task_t>& current  = get_cls()->current_task;
+
+  // Slots of the target move, so its descriptors must not be in use by a running thread other than the caller.
+  if (task_cap.task != current && task_cap.task->state != task_state_t::suspended) [[unlikely]] {
+    loge(tag, "This task is not suspended: %d", args->args[0]);
+    return sysret_e_ill_state();
+  }
+
+  uintptr_t   buf = args->args[1];
+  size_t      max = std::min<size_t>(args->args[2], CAP_REMAP_MAX_ENTRIES);
+  cap_remap_t remap[CAP_REMAP_MAX_ENTRIES] = {};
+  size_t      count = 0;
+
+  // Probe the whole buffer first. Once caps have moved, the remap table is the only record of their new descriptors.
+  if (max != 0 && !write_user_memory(current, make_map_ptr(remap), buf, sizeof(cap_remap_t) * max)) [[unlikely]] {
+    loge(tag, "Failed to write cap remap entries: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  if (!compact_cap_space(task_cap.task, remap, max, count)) [[unlikely]] {
+    loge(tag, "Failed to compact cap space: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  if (count != 0 && !write_user_memory(current, make_map_ptr(remap), buf, sizeof(cap_remap_t) * count)) [[unlikely]] {
+    loge(tag, "Failed to write cap remap entries: %p", buf);
+    return sysret_e_ill_args();
+  }
+
+  return sysret_s_ok(count);
+}
+
+sysret_t invoke_sys_task_cap_set_fault_endpoint(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> ep_cap_slot = lookup_cap(get_cls()->current_task, args->args[1]);
+
+  if (ep_cap_slot == nullptr) [[unlikely]] {
+    loge(tag, "Failed to look up cap: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  if (get_cap_type(ep_cap_slot->cap) != CAP_ENDPOINT) [[unlikely]] {
+    loge(tag, "Invalid cap type: %d", get_cap_type(ep_cap_slot->cap));
+    return sysret_e_cap_type();
+  }
+
+  set_fault_endpoint(cap_slot->cap.task.task, ep_cap_slot->cap.endpoint.endpoint);
+
+  return sysret_s_ok(0);
+}
+
+sysret_t invoke_sys_task_cap_clone(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_task_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  map_ptr<cap_slot_t> src_cap_slot = lookup_cap(get_cls()->current_task, args->args[1]);
+
+  if (src_cap_slot == nullptr) [[unlikely]] {
+    loge(tag, "Failed to look up cap: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  if (get_cap_type(src_cap_slot->cap) != CAP_TASK) [[unlikely]] {
+    loge(tag, "Invalid cap type: %d", get_cap_type(src_cap_slot->cap));
+    return sysret_e_cap_type();
+  }
+
+  map_ptr<cap_slot_t> mem_slot = lookup_cap(get_cls()->current_task, args->args[2]);
+
+  if (mem_slot == nullptr) [[unlikely]] {
+    loge(tag, "Failed to look up cap: %d", args->args[2]);
+    return errno_to_sysret();
+  }
+
+  if (get_cap_type(mem_slot->cap) != CAP_MEM) [[unlikely]] {
+    loge(tag, "Invalid cap type: %d", get_cap_type(mem_slot->cap));
+    return sysret_e_cap_type();
+  }
+
+  if (!clone_address_space(cap_slot->cap.task.task, src_cap_slot->cap.task.task, mem_slot)) [[unlikely]] {
+    loge(tag, "Failed to clone address space: %d", args->args[1]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
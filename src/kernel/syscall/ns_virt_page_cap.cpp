@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include <kernel/cap_space.h>
 #include <kernel/cls.h>
 #include <kernel/log.h>
@@ -100,3 +102,40 @@ sysret_t invoke_sys_virt_page_cap_virt_addr(map_ptr<syscall_args_t> args) {
 
   return sysret_s_ok(cap_slot->cap.virt_page.address.raw());
 }
+
+sysret_t invoke_sys_virt_page_cap_mem_type(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_virt_page_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(cap_slot->cap.virt_page.mem_type);
+}
+
+sysret_t invoke_sys_virt_page_cap_read_only(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_virt_page_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(cap_slot->cap.virt_page.read_only);
+}
+
+sysret_t invoke_sys_virt_page_cap_set_read_only(map_ptr<syscall_args_t> args) {
+  map_ptr<cap_slot_t> cap_slot = lookup_virt_page_cap(args);
+
+  if (cap_slot == nullptr) [[unlikely]] {
+    return errno_to_sysret();
+  }
+
+  std::lock_guard lock(get_cls()->current_task->lock);
+
+  if (!set_virt_page_read_only(cap_slot)) [[unlikely]] {
+    loge(tag, "Failed to make virt page read-only: %d", args->args[0]);
+    return errno_to_sysret();
+  }
+
+  return sysret_s_ok(0);
+}
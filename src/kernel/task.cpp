@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <csetjmp>
@@ -11,9 +12,12 @@
 #include <kernel/ipc.h>
 #include <kernel/lock.h>
 #include <kernel/log.h>
+#include <kernel/mem_ops.h>
+#include <kernel/rcu.h>
 #include <kernel/task.h>
 #include <kernel/trap.h>
 #include <kernel/user_memory.h>
+#include <kernel/zero_pool.h>
 #include <libcaprese/syscall.h>
 
 namespace {
@@ -32,6 +36,63 @@ namespace {
     ++cur_tid;
     return std::bit_cast<tid_t>(cur_tid);
   }
+
+  // Returns false if the owner is busy. Waiting for it here could deadlock, since the caller may already hold another task lock.
+  bool flush_slot_magazine(slot_magazine_t& magazine) {
+    if (magazine.count == 0) {
+      return true;
+    }
+
+    map_ptr<task_t> owner = lookup_tid(magazine.tid);
+    if (owner == nullptr) {
+      magazine.count = 0;
+      return true;
+    }
+
+    std::unique_lock lock(owner->lock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return false;
+    }
+
+    // The owner rebuilt its free slots after the magazine was filled, so the cached slots are already back in its free list.
+    if (magazine.generation != owner->slot_generation) {
+      magazine.count = 0;
+      return true;
+    }
+
+    while (magazine.count > 0) {
+      push_free_slots(owner, magazine.slots[--magazine.count]);
+    }
+
+    return true;
+  }
+
+  // The caller holds the locks of the task and the endpoint.
+  void unlink_endpoint_ref(map_ptr<task_t>& head, map_ptr<task_t> task, map_ptr<task_t> task_t::* next) {
+    map_ptr<task_t>* link = &head;
+    while (*link != task) {
+      assert(*link != nullptr);
+      link = &((*link).get()->*next);
+    }
+    *link             = task.get()->*next;
+    task.get()->*next = 0_map;
+  }
+
+  // Registers ep in the field of the task and links the task into the list of ep, so that destroying ep can clear the field.
+  void set_endpoint_ref(map_ptr<task_t> task, map_ptr<endpoint_t> task_t::* field, map_ptr<task_t> endpoint_t::* head, map_ptr<task_t> task_t::* next, map_ptr<endpoint_t> ep) {
+    map_ptr<endpoint_t> old = task.get()->*field;
+    if (old != nullptr) {
+      std::lock_guard ep_lock(old->lock);
+      unlink_endpoint_ref(old.get()->*head, task, next);
+    }
+
+    task.get()->*field = ep;
+    if (ep != nullptr) {
+      std::lock_guard ep_lock(ep->lock);
+      task.get()->*next = ep.get()->*head;
+      ep.get()->*head   = task;
+    }
+  }
 } // namespace
 
 void init_task(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, map_ptr<page_table_t> root_page_table, map_ptr<page_table_t> (&cap_space_page_tables)[NUM_INTER_PAGE_TABLE + 1]) {
@@ -46,24 +107,38 @@ void init_task(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, map_ptr<pag
 
   std::lock_guard lock(task->lock);
 
-  task->cap_count         = {};
-  task->prev_ready_task   = 0_map;
-  task->next_ready_task   = 0_map;
-  task->prev_waiting_task = 0_map;
-  task->next_waiting_task = 0_map;
-  task->caller_task       = 0_map;
-  task->callee_task       = 0_map;
-  task->free_slots        = 0_map;
-  task->free_slots_count  = 0;
-  task->root_page_table   = root_page_table;
-  task->kill_notify       = 0_map;
-  task->state             = task_state_t::suspended;
-  task->ipc_state         = ipc_state_t::none;
-  task->ipc_msg_state     = ipc_msg_state_t::empty;
-  task->event_type        = event_type_t::none;
-  task->exit_status       = 0;
-
-  memset(root_page_table.get(), 0, sizeof(page_table_t));
+  task->cap_count             = {};
+  task->prev_ready_task       = 0_map;
+  task->next_ready_task       = 0_map;
+  task->prev_waiting_task     = 0_map;
+  task->next_waiting_task     = 0_map;
+  task->caller_task           = 0_map;
+  task->callee_task           = 0_map;
+  task->free_slots            = 0_map;
+  task->free_slots_count      = 0;
+  task->deferred_slots_head   = 0_map;
+  task->deferred_slots_tail   = 0_map;
+  task->deferred_slots_count  = 0;
+  task->fresh_cap_spaces      = 0_map;
+  task->cap_spaces            = 0_map;
+  task->slot_generation       = 0;
+  task->cap_guard             = 0;
+  task->root_page_table       = root_page_table;
+  task->kill_notify           = 0_map;
+  task->fault_endpoint        = 0_map;
+  task->next_kill_notify_task = 0_map;
+  task->next_fault_task       = 0_map;
+  task->cow_memory            = 0_map;
+  task->next_cow_memory_task  = 0_map;
+  task->cow_memory_tasks      = 0_map;
+  task->state                 = task_state_t::suspended;
+  task->cap_layout            = cap_layout_t::dense;
+  task->ipc_state             = ipc_state_t::none;
+  task->ipc_msg_state         = ipc_msg_state_t::empty;
+  task->event_type            = event_type_t::none;
+  task->exit_status           = 0;
+
+  zero_memory(root_page_table.get(), sizeof(page_table_t));
 
   constexpr size_t max_page_size = get_page_size(MAX_PAGE_TABLE_LEVEL);
   static_assert(std::countr_zero(CONFIG_MAPPED_SPACE_BASE) >= std::countr_zero(max_page_size));
@@ -73,10 +148,11 @@ void init_task(map_ptr<task_t> task, map_ptr<cap_space_t> cap_space, map_ptr<pag
     pte->set_flags({ .readable = 1, .writable = 1, .executable = 1, .user = 0, .global = 1 });
     pte->set_next_page(make_phys_ptr(phys));
     pte->enable();
+    preempt_point();
   }
 
   for (auto& table : cap_space_page_tables) {
-    memset(table.get(), 0, sizeof(page_table_t));
+    zero_memory(table.get(), sizeof(page_table_t));
   }
 
   map_ptr<page_table_t> page_table = root_page_table;
@@ -117,7 +193,7 @@ void init_idle_task(map_ptr<task_t> task, map_ptr<page_table_t> root_page_table)
   task->root_page_table   = root_page_table;
   task->state             = task_state_t::ready;
 
-  memset(root_page_table.get(), 0, sizeof(page_table_t));
+  zero_memory(root_page_table.get(), sizeof(page_table_t));
 
   constexpr size_t max_page_size = get_page_size(MAX_PAGE_TABLE_LEVEL);
   static_assert(std::countr_zero(CONFIG_MAPPED_SPACE_BASE) >= std::countr_zero(max_page_size));
@@ -159,8 +235,9 @@ void push_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot) {
 
   std::lock_guard lock(task->lock);
 
+  slot->cap   = make_null_cap();
+  slot->depth = 0;
   slot->erase_this();
-  slot->cap = make_null_cap();
 
   if (task->free_slots != nullptr) {
     task->free_slots->insert_before(slot);
@@ -171,12 +248,92 @@ void push_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot) {
   ++task->free_slots_count;
 }
 
+// Unlike pop_free_slots, this bypasses the magazine and the deferred slots. The caller must hold the task lock.
+map_ptr<cap_slot_t> take_free_slot(map_ptr<task_t> task) {
+  assert(task != nullptr);
+
+  map_ptr<cap_slot_t> slot = task->free_slots;
+
+  if (slot != nullptr) {
+    task->free_slots = slot->erase_this();
+  } else {
+    map_ptr<cap_space_t> cap_space = task->fresh_cap_spaces;
+    if (cap_space == nullptr) [[unlikely]] {
+      return 0_map;
+    }
+
+    slot       = make_map_ptr(&cap_space->slots[cap_space->meta_info.watermark++]);
+    slot->cap  = make_null_cap();
+    slot->prev = 0_map;
+    slot->next = 0_map;
+
+    if (cap_space->meta_info.watermark == std::size(cap_space->slots)) {
+      task->fresh_cap_spaces = cap_space->meta_info.next_fresh;
+    }
+  }
+
+  slot->depth = 0;
+  --task->free_slots_count;
+
+  return slot;
+}
+
+// Takes count consecutive slots from the never-used part of one cap space, so that their descriptors are consecutive. The caller must hold the task lock.
+map_ptr<cap_slot_t> take_fresh_slots(map_ptr<task_t> task, size_t count) {
+  assert(task != nullptr);
+  assert(count > 0);
+
+  for (map_ptr<cap_space_t>* link = &task->fresh_cap_spaces; *link != nullptr; link = &(*link)->meta_info.next_fresh) {
+    map_ptr<cap_space_t> cap_space = *link;
+    if (std::size(cap_space->slots) - cap_space->meta_info.watermark < count) {
+      continue;
+    }
+
+    map_ptr<cap_slot_t> slots = make_map_ptr(&cap_space->slots[cap_space->meta_info.watermark]);
+    for (size_t i = 0; i < count; ++i) {
+      slots[i].cap   = make_null_cap();
+      slots[i].prev  = 0_map;
+      slots[i].next  = 0_map;
+      slots[i].depth = 0;
+    }
+
+    cap_space->meta_info.watermark += count;
+    task->free_slots_count         -= count;
+
+    if (cap_space->meta_info.watermark == std::size(cap_space->slots)) {
+      *link = cap_space->meta_info.next_fresh;
+    }
+
+    return slots;
+  }
+
+  return 0_map;
+}
+
 [[nodiscard]] map_ptr<cap_slot_t> pop_free_slots(map_ptr<task_t> task) {
   assert(task != nullptr);
 
+  slot_magazine_t& magazine = get_cls()->slot_magazine;
+
+  if (magazine.tid == task->tid && magazine.generation == task->slot_generation && magazine.count > 0) [[likely]] {
+    return magazine.slots[--magazine.count];
+  }
+
+  bool refill = magazine.tid == task->tid || flush_slot_magazine(magazine);
+  if (refill) {
+    magazine.tid = task->tid;
+  }
+
   std::lock_guard lock(task->lock);
 
-  map_ptr<cap_slot_t> slot = task->free_slots;
+  if (refill && magazine.generation != task->slot_generation) {
+    magazine.count      = 0;
+    magazine.generation = task->slot_generation;
+  }
+
+  reclaim_deferred_slots(task);
+
+  map_ptr<cap_slot_t> slot = take_free_slot(task);
 
   if (slot == nullptr) [[unlikely]] {
     logd(tag, "Failed to pop from the free slot. The free slot is empty.");
@@ -184,13 +341,79 @@ void push_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot) {
     return 0_map;
   }
 
-  task->free_slots = slot->erase_this();
-
-  --task->free_slots_count;
+  while (refill && magazine.count < std::size(magazine.slots)) {
+    map_ptr<cap_slot_t> cached_slot = take_free_slot(task);
+    if (cached_slot == nullptr) {
+      break;
+    }
+    magazine.slots[magazine.count++] = cached_slot;
+  }
 
   return slot;
 }
 
+void defer_free_slots(map_ptr<task_t> task, map_ptr<cap_slot_t> slot) {
+  assert(task != nullptr);
+  assert(slot != nullptr);
+  assert(slot->get_cap_space()->meta_info.task == task);
+
+  std::lock_guard lock(task->lock);
+
+  // The slot may be reused for another memory cap, so no task may keep it for copy-on-write.
+  replace_cow_memory(task, slot, 0_map);
+
+  // Lock-free readers may still hold this slot. Make it read as null before unlinking it, and keep it out of the free list until a grace period has elapsed.
+  slot->cap = make_null_cap();
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->erase_this();
+
+  slot->cap.null.unused2 = rcu_retire_epoch();
+  slot->depth            = DEFERRED_SLOT_DEPTH;
+
+  if (task->deferred_slots_tail != nullptr) {
+    task->deferred_slots_tail->next = slot;
+  } else {
+    task->deferred_slots_head = slot;
+  }
+  task->deferred_slots_tail = slot;
+  ++task->deferred_slots_count;
+}
+
+void reclaim_deferred_slots(map_ptr<task_t> task) {
+  assert(task != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  // Deferred slots are queued in retirement order, so stop at the first one whose grace period has not elapsed.
+  while (task->deferred_slots_head != nullptr && rcu_is_expired(task->deferred_slots_head->cap.null.unused2)) {
+    map_ptr<cap_slot_t> slot  = task->deferred_slots_head;
+    task->deferred_slots_head = slot->next;
+    if (task->deferred_slots_head == nullptr) {
+      task->deferred_slots_tail = 0_map;
+    }
+    slot->next = 0_map;
+    --task->deferred_slots_count;
+    push_free_slots(task, slot);
+  }
+}
+
+// Slots waiting for a grace period and slots cached on this core are counted, since the task can still allocate them.
+// Slots cached on other cores are not, so the count may be short by up to SLOT_MAGAZINE_SIZE per core.
+size_t get_free_slot_count(map_ptr<task_t> task) {
+  assert(task != nullptr);
+
+  slot_magazine_t& magazine = get_cls()->slot_magazine;
+
+  std::lock_guard lock(task->lock);
+
+  size_t count = task->free_slots_count + task->deferred_slots_count;
+  if (magazine.tid == task->tid && magazine.generation == task->slot_generation) {
+    count += magazine.count;
+  }
+
+  return count;
+}
+
 void kill_task(map_ptr<task_t> task, int exit_status) {
   assert(task != nullptr);
 
@@ -237,6 +460,9 @@ void kill_task(map_ptr<task_t> task, int exit_status) {
     ipc_send_kill_notify(task->kill_notify, task);
   }
 
+  set_endpoint_ref(task, &task_t::kill_notify, &endpoint_t::kill_notify_tasks, &task_t::next_kill_notify_task, 0_map);
+  set_endpoint_ref(task, &task_t::fault_endpoint, &endpoint_t::fault_tasks, &task_t::next_fault_task, 0_map);
+
   logd(tag, "Task 0x%x has been killed. status: %d", task->tid, exit_status);
 
   if (task->tid.index == 1) [[unlikely]] {
@@ -315,12 +541,100 @@ void set_kill_notify(map_ptr<task_t> task, map_ptr<endpoint_t> ep) {
 
   std::lock_guard lock(task->lock);
 
-  if (task->state == task_state_t::unused) [[unlikely]] {
+  if (task->state == task_state_t::unused || task->state == task_state_t::killed) [[unlikely]] {
+    errno = SYS_E_ILL_STATE;
+    return;
+  }
+
+  set_endpoint_ref(task, &task_t::kill_notify, &endpoint_t::kill_notify_tasks, &task_t::next_kill_notify_task, ep);
+}
+
+void set_fault_endpoint(map_ptr<task_t> task, map_ptr<endpoint_t> ep) {
+  assert(task != nullptr);
+  assert(ep != nullptr);
+
+  std::lock_guard lock(task->lock);
+
+  if (task->state == task_state_t::unused || task->state == task_state_t::killed) [[unlikely]] {
     errno = SYS_E_ILL_STATE;
     return;
   }
 
-  task->kill_notify = ep;
+  set_endpoint_ref(task, &task_t::fault_endpoint, &endpoint_t::fault_tasks, &task_t::next_fault_task, ep);
+}
+
+// The caller holds the locks of the task and of the tasks holding its old and new memory caps.
+void set_cow_memory(map_ptr<task_t> task, map_ptr<cap_slot_t> mem_slot) {
+  assert(task != nullptr);
+
+  if (task->cow_memory == mem_slot) {
+    return;
+  }
+
+  if (task->cow_memory != nullptr) {
+    map_ptr<task_t>* link = &task->cow_memory->get_cap_space()->meta_info.task->cow_memory_tasks;
+    while (*link != task) {
+      assert(*link != nullptr);
+      link = &(*link)->next_cow_memory_task;
+    }
+    *link                      = task->next_cow_memory_task;
+    task->next_cow_memory_task = 0_map;
+  }
+
+  task->cow_memory = mem_slot;
+
+  if (mem_slot != nullptr) {
+    map_ptr<task_t> mem_task   = mem_slot->get_cap_space()->meta_info.task;
+    task->next_cow_memory_task = mem_task->cow_memory_tasks;
+    mem_task->cow_memory_tasks = task;
+  }
+}
+
+// Called with the lock of mem_task held when old_slot stops holding the memory cap. A null new_slot unregisters it.
+void replace_cow_memory(map_ptr<task_t> mem_task, map_ptr<cap_slot_t> old_slot, map_ptr<cap_slot_t> new_slot) {
+  assert(mem_task != nullptr);
+
+  map_ptr<task_t>* link = &mem_task->cow_memory_tasks;
+  while (*link != nullptr) {
+    map_ptr<task_t> task = *link;
+    if (task->cow_memory != old_slot) {
+      link = &task->next_cow_memory_task;
+      continue;
+    }
+
+    task->cow_memory = new_slot;
+    if (new_slot == nullptr) {
+      *link                      = task->next_cow_memory_task;
+      task->next_cow_memory_task = 0_map;
+    } else {
+      link = &task->next_cow_memory_task;
+    }
+  }
+}
+
+// Task locks are taken before endpoint locks, so each task is picked under the endpoint lock and checked again once both are held.
+void clear_endpoint_refs(map_ptr<endpoint_t> ep) {
+  assert(ep != nullptr);
+
+  while (true) {
+    map_ptr<task_t> task = 0_map;
+    {
+      std::lock_guard ep_lock(ep->lock);
+      task = ep->kill_notify_tasks != nullptr ? ep->kill_notify_tasks : ep->fault_tasks;
+    }
+
+    if (task == nullptr) {
+      break;
+    }
+
+    std::lock_guard lock(task->lock);
+    if (task->kill_notify == ep) {
+      set_endpoint_ref(task, &task_t::kill_notify, &endpoint_t::kill_notify_tasks, &task_t::next_kill_notify_task, 0_map);
+    }
+    if (task->fault_endpoint == ep) {
+      set_endpoint_ref(task, &task_t::fault_endpoint, &endpoint_t::fault_tasks, &task_t::next_fault_task, 0_map);
+    }
+  }
 }
 
 void push_ready_queue(map_ptr<task_t> task) {
@@ -329,7 +643,7 @@ void push_ready_queue(map_ptr<task_t> task) {
   assert(task->prev_ready_task == nullptr);
   assert(task->next_ready_task == nullptr);
 
-  std::lock_guard lock(ready_queue_lock);
+  irqsave_lock_guard lock(ready_queue_lock);
 
   if (ready_queue.head == nullptr) {
     ready_queue.head = task;
@@ -345,7 +659,7 @@ void remove_ready_queue(map_ptr<task_t> task) {
   assert(task != nullptr);
   assert(task->state == task_state_t::ready);
 
-  std::lock_guard lock(ready_queue_lock);
+  irqsave_lock_guard lock(ready_queue_lock);
 
   if (ready_queue.head == task) {
     ready_queue.head = task->next_ready_task;
@@ -364,7 +678,7 @@ void remove_ready_queue(map_ptr<task_t> task) {
 }
 
 map_ptr<task_t> pop_ready_task() {
-  std::lock_guard lock(ready_queue_lock);
+  irqsave_lock_guard lock(ready_queue_lock);
 
   map_ptr<task_t> task = ready_queue.head;
   if (task == nullptr) [[unlikely]] {
@@ -426,11 +740,27 @@ void yield() {
   resched();
 }
 
+bool preempt_point() {
+  // The kernel runs with interrupts masked. Open a short window so that pending interrupts are taken here instead of at the next return to user mode.
+  if (irq_pending()) [[unlikely]] {
+    irq_enable();
+    irq_disable();
+  }
+
+  // Switching away here would let the idle loop report a quiescent state while the caller still holds slots from lock-free lookups.
+  // Callers that can be restarted stop instead when this returns true, and the task is rescheduled on the return path.
+  return get_cls()->need_resched;
+}
+
 void idle() {
   while (true) {
+    rcu_quiescent_state();
+
     map_ptr<task_t> task = pop_ready_task();
     if (task == nullptr) {
-      // TODO: wait for interrupt.
+      // Spend the idle time on zeroing pages for object creation.
+      // TODO: wait for interrupt when there is no zeroing work either.
+      zero_pool_work();
       continue;
     }
     get_cls()->current_task = task;
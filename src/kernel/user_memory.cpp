@@ -1,10 +1,32 @@
-#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <tuple>
 #include <utility>
 
+#include <kernel/cap.h>
+#include <kernel/mem_ops.h>
 #include <kernel/user_memory.h>
+#include <libcaprese/syscall.h>
 
 namespace {
-  std::pair<map_ptr<pte_t>, int> walk(map_ptr<task_t> task, uintptr_t va) {
+  // The hardware may update the bits concurrently, so they are set with the same atomicity as scan_accessed_dirty clears them.
+  void mark_accessed_dirty(pte_t& entry) {
+    std::atomic_ref<pte_t> pte(entry);
+    pte_t                  old_pte = pte.load(std::memory_order_relaxed);
+    pte_t                  new_pte;
+    do {
+      if (old_pte.a && old_pte.d) {
+        break;
+      }
+      new_pte   = old_pte;
+      new_pte.a = 1;
+      new_pte.d = 1;
+    } while (!pte.compare_exchange_weak(old_pte, new_pte, std::memory_order_relaxed));
+  }
+
+  // Returns the leaf entry and the size of the range it maps. A NAPOT entry maps its whole range from the base it returns.
+  std::pair<map_ptr<pte_t>, size_t> walk(map_ptr<task_t> task, uintptr_t va) {
     map_ptr<page_table_t> page_table = task->root_page_table;
     map_ptr<pte_t>        pte        = 0_map;
     int                   level      = MAX_PAGE_TABLE_LEVEL;
@@ -12,7 +34,7 @@ namespace {
     for (; level >= 0; --level) {
       pte = page_table->walk(make_virt_ptr(va), level);
       if (pte->is_disabled()) {
-        return std::pair<map_ptr<pte_t>, int> { 0_map, 0 };
+        return std::pair<map_ptr<pte_t>, size_t> { 0_map, 0 };
       }
 
       if (!pte->is_table()) {
@@ -23,10 +45,10 @@ namespace {
     }
 
     if (pte->is_disabled() || pte->is_table() || !pte->is_user()) {
-      return std::pair<map_ptr<pte_t>, int> { 0_map, 0 };
+      return std::pair<map_ptr<pte_t>, size_t> { 0_map, 0 };
     }
 
-    return std::pair<map_ptr<pte_t>, int> { pte, level };
+    return std::pair<map_ptr<pte_t>, size_t> { pte, pte->n ? NAPOT_PAGE_SIZE : get_page_size(level) };
   }
 } // namespace
 
@@ -34,19 +56,18 @@ bool read_user_memory(map_ptr<task_t> task, uintptr_t src, map_ptr<void> dst, si
   size_t read = 0;
 
   while (read < size) {
-    auto [pte, level] = walk(task, src + read);
+    auto [pte, page_size] = walk(task, src + read);
     if (pte == nullptr) {
       return false;
     }
 
-    size_t page_size = get_page_size(level);
-    size_t offset    = (src + read) & (page_size - 1);
-    size_t length    = page_size - offset;
+    size_t offset = (src + read) & (page_size - 1);
+    size_t length = page_size - offset;
     if (length > size - read) {
       length = size - read;
     }
 
-    memcpy((dst.template as<void>() + read).get(), (pte->get_next_page() + offset).get(), length);
+    copy_memory((dst.template as<void>() + read).get(), (pte->get_next_page() + offset).get(), length);
     read += length;
   }
 
@@ -57,19 +78,31 @@ bool write_user_memory(map_ptr<task_t> task, map_ptr<void> src, uintptr_t dst, s
   size_t written = 0;
 
   while (written < size) {
-    auto [pte, level] = walk(task, dst + written);
+    auto [pte, page_size] = walk(task, dst + written);
     if (pte == nullptr) {
       return false;
     }
 
-    size_t page_size = get_page_size(level);
-    size_t offset    = (dst + written) & (page_size - 1);
-    size_t length    = page_size - offset;
+    // The kernel writes through the physical mapping, so a page shared for copy-on-write is copied first and a read-only page is refused.
+    if (pte->cow) {
+      if (!copy_on_write(task, make_virt_ptr(dst + written))) {
+        return false;
+      }
+      std::tie(pte, page_size) = walk(task, dst + written);
+    } else if (!pte->w) {
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    size_t offset = (dst + written) & (page_size - 1);
+    size_t length = page_size - offset;
     if (length > size - written) {
       length = size - written;
     }
 
-    memcpy((pte->get_next_page() + offset).get(), (src.template as<void>() + written).get(), length);
+    // Writes through the physical mapping are not seen by the MMU, so they are recorded for dirty tracking here.
+    mark_accessed_dirty(*pte);
+    copy_memory((pte->get_next_page() + offset).get(), (src.template as<void>() + written).get(), length);
     written += length;
   }
 
@@ -80,32 +113,44 @@ bool forward_user_memory(map_ptr<task_t> src_task, map_ptr<task_t> dst_task, uin
   size_t forwarded = 0;
 
   while (forwarded < size) {
-    auto [src_pte, src_level] = walk(src_task, src + forwarded);
+    auto [src_pte, src_page_size] = walk(src_task, src + forwarded);
     if (src_pte == nullptr) {
       return false;
     }
 
-    auto [dst_pte, dst_level] = walk(dst_task, dst + forwarded);
+    auto [dst_pte, dst_page_size] = walk(dst_task, dst + forwarded);
     if (dst_pte == nullptr) {
       return false;
     }
 
-    size_t src_page_size = get_page_size(src_level);
-    size_t src_offset    = (src + forwarded) & (src_page_size - 1);
-    size_t src_length    = src_page_size - src_offset;
+    if (dst_pte->cow) {
+      if (!copy_on_write(dst_task, make_virt_ptr(dst + forwarded))) {
+        return false;
+      }
+      std::tie(dst_pte, dst_page_size) = walk(dst_task, dst + forwarded);
+    } else if (!dst_pte->w) {
+      errno = SYS_E_ILL_ARGS;
+      return false;
+    }
+
+    size_t src_offset = (src + forwarded) & (src_page_size - 1);
+    size_t src_length = src_page_size - src_offset;
     if (src_length > size - forwarded) {
       src_length = size - forwarded;
     }
 
-    size_t dst_page_size = get_page_size(dst_level);
-    size_t dst_offset    = (dst + forwarded) & (dst_page_size - 1);
-    size_t dst_length    = dst_page_size - dst_offset;
+    size_t dst_offset = (dst + forwarded) & (dst_page_size - 1);
+    size_t dst_length = dst_page_size - dst_offset;
     if (dst_length > size - forwarded) {
       dst_length = size - forwarded;
     }
 
-    memcpy((dst_pte->get_next_page() + dst_offset).get(), (src_pte->get_next_page() + src_offset).get(), src_length);
-    forwarded += src_length;
+    // Each step stays within both pages, which may have different sizes.
+    size_t length = std::min(src_length, dst_length);
+
+    mark_accessed_dirty(*dst_pte);
+    copy_memory((dst_pte->get_next_page() + dst_offset).get(), (src_pte->get_next_page() + src_offset).get(), length);
+    forwarded += length;
   }
 
   return true;
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+
+#include <kernel/address.h>
+#include <kernel/align.h>
+#include <kernel/lock.h>
+#include <kernel/mem_ops.h>
+#include <kernel/page.h>
+#include <kernel/zero_pool.h>
+
+namespace {
+  struct zero_region_t {
+    uintptr_t phys_addr;
+    size_t    size;
+    uintptr_t zeroed_begin;
+    uintptr_t zeroed_end;
+  };
+
+  spinlock_t          zero_pool_lock;
+  zero_region_t       regions[ZERO_POOL_MAX_REGIONS];
+  size_t              next_region;
+  std::atomic<size_t> num_regions;
+
+  zero_region_t* find_region(uintptr_t phys_addr, size_t size) {
+    for (auto& region : regions) {
+      if (region.size != 0 && region.phys_addr == phys_addr && region.size == size) {
+        return &region;
+      }
+    }
+    return nullptr;
+  }
+} // namespace
+
+bool add_zero_pool_region(uintptr_t phys_addr, size_t size, uintptr_t free_addr) {
+  std::lock_guard lock(zero_pool_lock);
+
+  if (find_region(phys_addr, size) != nullptr) {
+    return true;
+  }
+
+  for (auto& region : regions) {
+    if (region.size == 0) {
+      region = {
+        .phys_addr    = phys_addr,
+        .size         = size,
+        .zeroed_begin = free_addr,
+        .zeroed_end   = free_addr,
+      };
+      num_regions.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void remove_zero_pool_region(uintptr_t phys_addr, size_t size) {
+  if (num_regions.load(std::memory_order_relaxed) == 0) [[likely]] {
+    return;
+  }
+
+  std::lock_guard lock(zero_pool_lock);
+
+  zero_region_t* region = find_region(phys_addr, size);
+  if (region != nullptr) {
+    region->size = 0;
+    num_regions.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+// Every allocation from a registered region must come through here, so that idle cores never zero memory that is in use.
+bool take_zeroed_range(uintptr_t region_addr, size_t region_size, uintptr_t phys_addr, size_t size) {
+  if (num_regions.load(std::memory_order_relaxed) == 0) [[likely]] {
+    return false;
+  }
+
+  std::lock_guard lock(zero_pool_lock);
+
+  zero_region_t* region = find_region(region_addr, region_size);
+  if (region == nullptr) {
+    return false;
+  }
+
+  bool zeroed          = region->zeroed_begin <= phys_addr && phys_addr + size <= region->zeroed_end;
+  region->zeroed_begin = std::max(region->zeroed_begin, phys_addr + size);
+  region->zeroed_end   = std::max(region->zeroed_end, region->zeroed_begin);
+
+  return zeroed;
+}
+
+// Zeroes up to one page of a registered region. Returns false if there is nothing left to zero.
+bool zero_pool_work() {
+  if (num_regions.load(std::memory_order_relaxed) == 0) [[likely]] {
+    return false;
+  }
+
+  std::lock_guard lock(zero_pool_lock);
+
+  for (size_t i = 0; i < std::size(regions); ++i) {
+    zero_region_t& region = regions[(next_region + i) % std::size(regions)];
+    uintptr_t      end    = region.phys_addr + region.size;
+    if (region.size == 0 || region.zeroed_end >= end) {
+      continue;
+    }
+
+    size_t size = std::min(round_up(region.zeroed_end + 1, PAGE_SIZE), end) - region.zeroed_end;
+    zero_memory(phys_ptr<void>::from(region.zeroed_end).as_map().get(), size);
+    region.zeroed_end += size;
+
+    next_region = (next_region + i + 1) % std::size(regions);
+    return true;
+  }
+
+  return false;
+}